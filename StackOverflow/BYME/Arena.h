@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Entities refer to each other through 32-bit indexes into their arena
+// instead of shared_ptr, so a reference costs 4 bytes and no refcount.
+using Handle = std::uint32_t;
+const Handle INVALID_HANDLE = UINT32_MAX;
+
+// Slab storage for one entity type. Objects are placed in fixed-size chunks,
+// so they stay contiguous, never move while the arena grows, and the handle
+// is simply the slot number.
+template <typename T, std::uint32_t ChunkBits = 12>
+class Arena
+{
+private:
+    static constexpr std::uint32_t CHUNK_SIZE = 1u << ChunkBits;
+    static constexpr std::uint32_t CHUNK_MASK = CHUNK_SIZE - 1;
+
+    std::vector<std::vector<T>> chunks;
+    std::vector<Handle> freeSlots;
+    std::uint32_t count = 0;
+
+public:
+    template <typename... Args>
+    Handle emplace(Args &&...args)
+    {
+        if (!freeSlots.empty())
+        {
+            Handle h = freeSlots.back();
+            freeSlots.pop_back();
+            (*this)[h] = T(std::forward<Args>(args)...);
+            return h;
+        }
+        if ((count & CHUNK_MASK) == 0)
+        {
+            chunks.emplace_back();
+            chunks.back().reserve(CHUNK_SIZE);
+        }
+        chunks.back().emplace_back(std::forward<Args>(args)...);
+        return count++;
+    }
+
+    // The slot is recycled by the next emplace; the caller must drop every
+    // reference to the handle first.
+    void release(Handle h)
+    {
+        freeSlots.push_back(h);
+    }
+
+    T &operator[](Handle h)
+    {
+        return chunks[h >> ChunkBits][h & CHUNK_MASK];
+    }
+
+    const T &operator[](Handle h) const
+    {
+        return chunks[h >> ChunkBits][h & CHUNK_MASK];
+    }
+
+    // Number of slots handed out, including released ones.
+    std::uint32_t size() const
+    {
+        return count;
+    }
+
+    std::size_t liveCount() const
+    {
+        return count - freeSlots.size();
+    }
+
+    // Bytes reserved for the slots themselves; heap memory owned by the
+    // objects is not included.
+    std::size_t slabBytes() const
+    {
+        return chunks.size() * CHUNK_SIZE * sizeof(T) + freeSlots.capacity() * sizeof(Handle);
+    }
+};
+
+// Read-only window over a contiguous run of elements, e.g. one page of a
+// post's answers. It borrows the storage, so it is only valid until the
+// owning container next changes.
+template <typename T>
+class Slice
+{
+private:
+    const T *first = nullptr;
+    std::size_t count = 0;
+
+public:
+    Slice() = default;
+    Slice(const T *first, std::size_t count) : first(first), count(count) {}
+
+    const T *begin() const { return first; }
+    const T *end() const { return first + count; }
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T &operator[](std::size_t i) const { return first[i]; }
+};
+
+// Elements [offset, offset + limit) of items, clamped to its size.
+template <typename T>
+Slice<T> pageOf(const std::vector<T> &items, std::size_t offset, std::size_t limit)
+{
+    if (offset >= items.size())
+    {
+        return Slice<T>();
+    }
+    return Slice<T>(items.data() + offset, std::min(limit, items.size() - offset));
+}
+
+// Heap bytes behind a member, for memory accounting.
+template <typename T>
+std::size_t ownedBytes(const std::vector<T> &items)
+{
+    return items.capacity() * sizeof(T);
+}
+
+inline std::size_t ownedBytes(const std::string &s)
+{
+    // Short strings live inside the object itself.
+    const char *self = reinterpret_cast<const char *>(&s);
+    return s.data() >= self && s.data() < self + sizeof(std::string) ? 0 : s.capacity() + 1;
+}
+
+// Location of a text body inside a TextPool.
+struct TextRef
+{
+    std::uint32_t chunk = 0;
+    std::uint32_t offset = 0;
+    std::uint32_t length = 0;
+};
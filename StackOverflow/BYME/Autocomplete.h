@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Arena.h"
+
+// Case-insensitive prefix completion over weighted keys (tag names ranked
+// by usage, usernames by reputation). Every trie node caches the TOP_N best
+// entries of its subtree, so a lookup is a walk down the prefix followed by
+// copying at most n cached handles. A weight change only recomputes the
+// caches on the key's own path, and stops climbing as soon as the entry
+// neither is nor could become part of a node's cache.
+class Autocomplete
+{
+public:
+    static constexpr std::size_t TOP_N = 8;
+
+private:
+    static constexpr std::uint32_t NONE = UINT32_MAX;
+
+    struct Node
+    {
+        std::vector<std::pair<char, std::uint32_t>> children; // sorted by char
+        std::vector<std::uint32_t> terminals; // keys ending here, e.g. "Bob" and "bob"
+        std::vector<std::uint32_t> top; // best entries of the subtree
+    };
+
+    struct Entry
+    {
+        Handle value;
+        std::int64_t weight;
+    };
+
+    std::vector<Node> nodes = std::vector<Node>(1);
+    std::vector<Entry> entries;
+
+    bool better(std::uint32_t a, std::uint32_t b) const
+    {
+        if (entries[a].weight != entries[b].weight)
+        {
+            return entries[a].weight > entries[b].weight;
+        }
+        return entries[a].value < entries[b].value;
+    }
+
+    std::uint32_t child(std::uint32_t node, char c) const
+    {
+        const auto &kids = nodes[node].children;
+        auto it = std::lower_bound(kids.begin(), kids.end(), c, [](const std::pair<char, std::uint32_t> &p, char ch)
+                                   { return p.first < ch; });
+        return it != kids.end() && it->first == c ? it->second : NONE;
+    }
+
+    std::uint32_t childOrCreate(std::uint32_t node, char c)
+    {
+        auto &kids = nodes[node].children;
+        auto it = std::lower_bound(kids.begin(), kids.end(), c, [](const std::pair<char, std::uint32_t> &p, char ch)
+                                   { return p.first < ch; });
+        if (it != kids.end() && it->first == c)
+        {
+            return it->second;
+        }
+        std::uint32_t created = static_cast<std::uint32_t>(nodes.size());
+        kids.insert(it, {c, created});
+        nodes.emplace_back();
+        return created;
+    }
+
+    void rebuildTop(std::uint32_t node)
+    {
+        std::vector<std::uint32_t> candidates = nodes[node].terminals;
+        for (auto &kid : nodes[node].children)
+        {
+            const auto &kidTop = nodes[kid.second].top;
+            candidates.insert(candidates.end(), kidTop.begin(), kidTop.end());
+        }
+        std::size_t keep = std::min(TOP_N, candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + keep, candidates.end(),
+                          [this](std::uint32_t a, std::uint32_t b)
+                          { return better(a, b); });
+        candidates.resize(keep);
+        nodes[node].top = std::move(candidates);
+    }
+
+    void propagate(const std::vector<std::uint32_t> &path, std::uint32_t entry)
+    {
+        for (std::size_t i = path.size(); i-- > 0;)
+        {
+            const auto &top = nodes[path[i]].top;
+            bool cached = std::find(top.begin(), top.end(), entry) != top.end();
+            bool qualifies = top.size() < TOP_N || better(entry, top.back());
+            if (!cached && !qualifies)
+            {
+                break;
+            }
+            rebuildTop(path[i]);
+        }
+    }
+
+    void collect(std::uint32_t node, std::vector<std::uint32_t> &out) const
+    {
+        out.insert(out.end(), nodes[node].terminals.begin(), nodes[node].terminals.end());
+        for (auto &kid : nodes[node].children)
+        {
+            collect(kid.second, out);
+        }
+    }
+
+public:
+    // Inserts the (key, value) pair, or updates its weight if present.
+    void setWeight(std::string_view key, Handle value, std::int64_t weight)
+    {
+        std::vector<std::uint32_t> path{0};
+        std::uint32_t node = 0;
+        for (char c : key)
+        {
+            node = childOrCreate(node, static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+            path.push_back(node);
+        }
+        auto &terminals = nodes[node].terminals;
+        auto it = std::find_if(terminals.begin(), terminals.end(), [&](std::uint32_t e)
+                               { return entries[e].value == value; });
+        std::uint32_t entry;
+        if (it == terminals.end())
+        {
+            entry = static_cast<std::uint32_t>(entries.size());
+            entries.push_back({value, weight});
+            terminals.push_back(entry);
+        }
+        else
+        {
+            entry = *it;
+            entries[entry].weight = weight;
+        }
+        propagate(path, entry);
+    }
+
+    // Values of the n best keys starting with prefix, best first.
+    std::vector<Handle> complete(std::string_view prefix, std::size_t n) const
+    {
+        std::vector<Handle> result;
+        std::uint32_t node = 0;
+        for (char c : prefix)
+        {
+            node = child(node, static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+            if (node == NONE)
+            {
+                return result;
+            }
+        }
+        std::vector<std::uint32_t> picked;
+        if (n <= TOP_N)
+        {
+            const auto &top = nodes[node].top;
+            picked.assign(top.begin(), top.begin() + std::min(n, top.size()));
+        }
+        else
+        {
+            // Deeper than the cache: fall back to ranking the whole subtree.
+            collect(node, picked);
+            std::size_t keep = std::min(n, picked.size());
+            std::partial_sort(picked.begin(), picked.begin() + keep, picked.end(),
+                              [this](std::uint32_t a, std::uint32_t b)
+                              { return better(a, b); });
+            picked.resize(keep);
+        }
+        for (std::uint32_t e : picked)
+        {
+            result.push_back(entries[e].value);
+        }
+        return result;
+    }
+};
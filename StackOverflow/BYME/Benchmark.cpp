@@ -0,0 +1,945 @@
+// Workload generator and benchmark driver for the StackOverflow engine.
+//
+//   g++ -std=c++17 -O2 -pthread Benchmark.cpp -o benchmark
+//   ./benchmark --sizes=10000,100000 --threads=1,2,4 --ops=200000
+//   ./benchmark --mix=search:25,view:45,vote:15,answer:8,comment:5,find:1
+//
+// For every corpus size a synthetic site is built (Zipfian word, tag and
+// author popularity), then the operation mix is replayed on each thread
+// count. Question and user choices are Zipfian too, so a few hot posts take
+// most of the traffic like on the real site. The engine itself is single
+// threaded; the harness guards it with a reader/writer lock (searches, views
+// and finds share it, votes, answers and comments take it exclusively), which
+// is what an embedding server would have to do today. With --pipeline the
+// writes go through a WritePipeline instead and reads use its published
+// state; write latency is then the time to enqueue, and the wall time
+// includes draining the queue.
+//
+// The substring scan behind findQuestion is linear in the corpus, so `find`
+// is off in the default mix and has to be asked for explicitly.
+//
+// --metrics prints the engine's own metrics export after each corpus size.
+//
+// --selftest runs correctness checks instead of the benchmark: the cold text
+// codec, a reopen after writes (snapshot plus event log) and reads, searches
+// and finds over cold blocks, each compared with an in-memory instance, the
+// import of a small dump fixture and WritePipeline batches against direct
+// calls. It exits non-zero if any check fails.
+//
+// Writes accumulate across runs of the same corpus size, so later thread
+// counts see a slightly larger site. Everything is seeded, so runs repeat.
+
+#include <bits/stdc++.h>
+#include <shared_mutex>
+#include "Solution.cpp"
+using namespace std;
+
+// Draws ranks 0..n-1 with P(rank) proportional to 1 / (rank + 1)^skew, then
+// maps ranks through a fixed shuffle so hot items are spread over the handle
+// range instead of all being the oldest ones.
+class ZipfGenerator
+{
+private:
+    vector<double> cdf;
+    vector<uint32_t> item;
+
+public:
+    ZipfGenerator(size_t n, double skew, uint64_t seed)
+        : cdf(n), item(n)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            sum += 1.0 / pow(double(i + 1), skew);
+            cdf[i] = sum;
+        }
+        for (double &c : cdf)
+        {
+            c /= sum;
+        }
+        iota(item.begin(), item.end(), 0);
+        shuffle(item.begin(), item.end(), mt19937_64(seed));
+    }
+
+    template <typename Rng>
+    uint32_t operator()(Rng &rng) const
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        size_t rank = lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return item[min(rank, item.size() - 1)];
+    }
+};
+
+enum class Op
+{
+    Search,
+    View,
+    Vote,
+    Answer,
+    Comment,
+    Find,
+    Count
+};
+
+const char *const OP_NAMES[] = {"search", "view", "vote", "answer", "comment", "find"};
+const size_t OP_COUNT = static_cast<size_t>(Op::Count);
+
+struct BenchConfig
+{
+    vector<size_t> sizes{10000, 100000};
+    vector<unsigned> threads{1, 2, 4};
+    size_t ops = 100000;
+    array<double, OP_COUNT> mix{25, 45, 15, 8, 5, 0};
+    double skew = 0.99;
+    uint64_t seed = 42;
+    bool pipeline = false;
+    bool metrics = false;
+    bool selfTest = false;
+};
+
+// Synthetic text: pronounceable words drawn from a Zipfian vocabulary, and
+// tags from a smaller Zipfian tag set.
+class TextGenerator
+{
+private:
+    vector<string> words;
+    vector<string> tagNames;
+    ZipfGenerator wordPick;
+    ZipfGenerator tagPick;
+
+    static string makeWord(mt19937_64 &rng)
+    {
+        static const char *const SYLLABLES[] = {"ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "xe", "zu",
+                                                "ar", "en", "il", "om", "ut", "sh", "qu", "pre", "con", "ing"};
+        string word;
+        int syllables = 1 + rng() % 4;
+        for (int i = 0; i < syllables; ++i)
+        {
+            word += SYLLABLES[rng() % size(SYLLABLES)];
+        }
+        return word;
+    }
+
+public:
+    TextGenerator(size_t vocabulary, size_t tagCount, double skew, uint64_t seed)
+        : wordPick(vocabulary, skew, seed), tagPick(tagCount, skew, seed + 1)
+    {
+        mt19937_64 rng(seed);
+        for (size_t i = 0; i < vocabulary; ++i)
+        {
+            words.push_back(makeWord(rng) + to_string(i % 97));
+        }
+        for (size_t i = 0; i < tagCount; ++i)
+        {
+            tagNames.push_back(makeWord(rng) + "-" + to_string(i));
+        }
+    }
+
+    template <typename Rng>
+    string sentence(Rng &rng, size_t minWords, size_t maxWords) const
+    {
+        size_t count = minWords + rng() % (maxWords - minWords + 1);
+        string text;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i > 0)
+            {
+                text.push_back(' ');
+            }
+            text += words[wordPick(rng)];
+        }
+        return text;
+    }
+
+    template <typename Rng>
+    const string &word(Rng &rng) const
+    {
+        return words[wordPick(rng)];
+    }
+
+    template <typename Rng>
+    const string &tag(Rng &rng) const
+    {
+        return tagNames[tagPick(rng)];
+    }
+};
+
+struct LatencyStats
+{
+    array<vector<uint32_t>, OP_COUNT> nanos; // one sample per operation
+};
+
+// Builds a site with `size` questions, about one answer and one comment per
+// question and a few votes each.
+void buildCorpus(StackOverflow &so, size_t size, const TextGenerator &text, const BenchConfig &config)
+{
+    mt19937_64 rng(config.seed);
+    size_t userCount = max<size_t>(1000, size / 10);
+    for (size_t i = 0; i < userCount; ++i)
+    {
+        so.createUser("user" + to_string(i), "Member " + to_string(i));
+    }
+    ZipfGenerator author(userCount, config.skew, config.seed + 2);
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < size; ++i)
+    {
+        QuestionHandle Q = so.addQuestion(author(rng), text.sentence(rng, 8, 60));
+        int tagCount = 1 + rng() % 4;
+        for (int t = 0; t < tagCount; ++t)
+        {
+            so.addTag(Q, text.tag(rng));
+        }
+    }
+    double questionSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ZipfGenerator popular(size, config.skew, config.seed + 3);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < size; ++i)
+    {
+        QuestionHandle Q = popular(rng);
+        AnswerHandle A = so.answerQuestion(author(rng), Q, text.sentence(rng, 10, 80));
+        so.addCommentOnQuestion(author(rng), Q, text.sentence(rng, 3, 20));
+        for (int v = 0; v < 3; ++v)
+        {
+            so.addVoteOnQuestion(author(rng), Q, rng() % 5 ? voteType::Upvote : voteType::Downvote);
+            so.addVoteOnAnswer(author(rng), A, rng() % 5 ? voteType::Upvote : voteType::Downvote);
+        }
+    }
+    double activitySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("corpus %zu questions, %zu users: questions %.2fs (%.0f/s), answers+comments+votes %.2fs (%.0f posts/s)\n",
+           size, userCount, questionSeconds, size / questionSeconds, activitySeconds, size * 2 / activitySeconds);
+
+    start = chrono::steady_clock::now();
+    size_t corrected = so.recomputeReputation();
+    printf("reputation recomputed from the ledger in %.3fs, %zu totals corrected\n",
+           chrono::duration<double>(chrono::steady_clock::now() - start).count(), corrected);
+}
+
+// How the workers reach the engine: behind a reader/writer lock, or
+// through a WritePipeline.
+class EngineAccess
+{
+private:
+    StackOverflow &so;
+    shared_mutex lock;
+    unique_ptr<WritePipeline> pipeline;
+
+public:
+    EngineAccess(StackOverflow &so, bool usePipeline) : so(so)
+    {
+        if (usePipeline)
+        {
+            pipeline = make_unique<WritePipeline>(so);
+        }
+    }
+
+    template <typename Fn>
+    auto read(Fn fn)
+    {
+        if (pipeline)
+        {
+            return pipeline->read(fn);
+        }
+        shared_lock<shared_mutex> guard(lock);
+        return fn(static_cast<const StackOverflow &>(so));
+    }
+
+    void voteOnQuestion(UserHandle U, QuestionHandle Q, voteType V)
+    {
+        if (pipeline)
+        {
+            pipeline->addVoteOnQuestion(U, Q, V);
+            return;
+        }
+        unique_lock<shared_mutex> guard(lock);
+        so.addVoteOnQuestion(U, Q, V);
+    }
+
+    void voteOnAnswer(UserHandle U, AnswerHandle A, voteType V)
+    {
+        if (pipeline)
+        {
+            pipeline->addVoteOnAnswer(U, A, V);
+            return;
+        }
+        unique_lock<shared_mutex> guard(lock);
+        so.addVoteOnAnswer(U, A, V);
+    }
+
+    void answer(UserHandle U, QuestionHandle Q, string body)
+    {
+        if (pipeline)
+        {
+            pipeline->answerQuestion(U, Q, move(body));
+            return;
+        }
+        unique_lock<shared_mutex> guard(lock);
+        so.answerQuestion(U, Q, body);
+    }
+
+    void comment(UserHandle U, QuestionHandle Q, string body)
+    {
+        if (pipeline)
+        {
+            pipeline->addCommentOnQuestion(U, Q, move(body));
+            return;
+        }
+        unique_lock<shared_mutex> guard(lock);
+        so.addCommentOnQuestion(U, Q, body);
+    }
+
+    void finish()
+    {
+        if (pipeline)
+        {
+            pipeline->flush();
+        }
+    }
+};
+
+// Runs config.ops operations of the mix spread over `threads` threads and
+// returns the wall time; per-operation latencies go to stats.
+double runMix(StackOverflow &so, size_t size, unsigned threads, const TextGenerator &text, const BenchConfig &config,
+              vector<LatencyStats> &stats)
+{
+    EngineAccess engine(so, config.pipeline);
+    size_t userCount = max<size_t>(1000, size / 10);
+    ZipfGenerator popular(size, config.skew, config.seed + 3);
+    ZipfGenerator actor(userCount, config.skew, config.seed + 4);
+    discrete_distribution<size_t> pickOp(config.mix.begin(), config.mix.end());
+
+    stats.assign(threads, LatencyStats());
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t]
+                             {
+                                 mt19937_64 rng(config.seed * 1000003 + t);
+                                 discrete_distribution<size_t> choose = pickOp;
+                                 size_t myOps = config.ops / threads + (t < config.ops % threads);
+                                 size_t checksum = 0;
+                                 for (size_t i = 0; i < myOps; ++i)
+                                 {
+                                     Op op = static_cast<Op>(choose(rng));
+                                     QuestionHandle Q = popular(rng);
+                                     UserHandle U = actor(rng);
+                                     // Inputs are generated before the clock starts.
+                                     string query, body;
+                                     if (op == Op::Search)
+                                     {
+                                         query = text.word(rng) + " " + text.word(rng) + (rng() % 4 ? "" : " " + text.tag(rng));
+                                     }
+                                     else if (op == Op::Find)
+                                     {
+                                         query = text.word(rng);
+                                     }
+                                     else if (op == Op::Answer || op == Op::Comment)
+                                     {
+                                         body = text.sentence(rng, op == Op::Answer ? 10 : 3, op == Op::Answer ? 80 : 20);
+                                     }
+                                     voteType vote = rng() % 5 ? voteType::Upvote : voteType::Downvote;
+                                     bool onAnswer = rng() % 2;
+
+                                     auto begin = chrono::steady_clock::now();
+                                     switch (op)
+                                     {
+                                     case Op::Search:
+                                         checksum += engine.read([&](const StackOverflow &so)
+                                                                 {
+                                                                     size_t bytes = 0;
+                                                                     for (const ScoredDoc &hit : so.searchQuestions(query))
+                                                                     {
+                                                                         bytes += so.getQuestionText(hit.doc).size();
+                                                                     }
+                                                                     return bytes; });
+                                         break;
+                                     case Op::View:
+                                         checksum += engine.read([&](const StackOverflow &so)
+                                                                 {
+                                                                     const Question &question = so.getQuestion(Q);
+                                                                     size_t bytes = so.getQuestionText(Q).size();
+                                                                     for (AnswerHandle A : question.getTopAnswers(0, 10))
+                                                                     {
+                                                                         bytes += so.getAnswerText(A).size();
+                                                                     }
+                                                                     for (CommentHandle C : question.getComments(0, 10))
+                                                                     {
+                                                                         bytes += so.getCommentText(C).size();
+                                                                     }
+                                                                     return bytes; });
+                                         break;
+                                     case Op::Vote:
+                                     {
+                                         AnswerHandle A = INVALID_HANDLE;
+                                         if (onAnswer)
+                                         {
+                                             A = engine.read([&](const StackOverflow &so)
+                                                             {
+                                                                 const Question &question = so.getQuestion(Q);
+                                                                 return question.getAnswerCount() > 0 ? question.getTopAnswers(0, 1)[0] : INVALID_HANDLE; });
+                                         }
+                                         if (A != INVALID_HANDLE)
+                                         {
+                                             engine.voteOnAnswer(U, A, vote);
+                                         }
+                                         else
+                                         {
+                                             engine.voteOnQuestion(U, Q, vote);
+                                         }
+                                         break;
+                                     }
+                                     case Op::Answer:
+                                         engine.answer(U, Q, move(body));
+                                         break;
+                                     case Op::Comment:
+                                         engine.comment(U, Q, move(body));
+                                         break;
+                                     case Op::Find:
+                                         checksum += engine.read([&](const StackOverflow &so)
+                                                                 { return so.findQuestion(query).size(); });
+                                         break;
+                                     default:
+                                         break;
+                                     }
+                                     auto nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+                                     stats[t].nanos[static_cast<size_t>(op)].push_back(static_cast<uint32_t>(min<int64_t>(nanos, UINT32_MAX)));
+                                 }
+                                 // Keeps the reads from being optimized away.
+                                 if (checksum == 1)
+                                 {
+                                     putchar(' ');
+                                 } });
+    }
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+    engine.finish();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void report(unsigned threads, double seconds, const vector<LatencyStats> &stats)
+{
+    size_t total = 0;
+    for (auto &s : stats)
+    {
+        for (auto &samples : s.nanos)
+        {
+            total += samples.size();
+        }
+    }
+    printf("  threads %u: %zu ops in %.2fs, %.0f ops/s\n", threads, total, seconds, total / seconds);
+    printf("    %-8s %9s %10s %10s %10s %10s %10s %10s\n", "op", "count", "ops/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+    for (size_t op = 0; op < OP_COUNT; ++op)
+    {
+        vector<uint32_t> all;
+        for (auto &s : stats)
+        {
+            all.insert(all.end(), s.nanos[op].begin(), s.nanos[op].end());
+        }
+        if (all.empty())
+        {
+            continue;
+        }
+        sort(all.begin(), all.end());
+        auto pct = [&](double p)
+        {
+            return all[min(all.size() - 1, static_cast<size_t>(p * all.size()))] / 1000.0;
+        };
+        printf("    %-8s %9zu %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", OP_NAMES[op], all.size(), all.size() / seconds,
+               pct(0.5), pct(0.9), pct(0.99), pct(0.999), all.back() / 1000.0);
+    }
+}
+
+// Prints a failed check; returns ok so checks can be chained.
+bool expect(bool ok, const string &what)
+{
+    if (!ok)
+    {
+        printf("    FAIL: %s\n", what.c_str());
+    }
+    return ok;
+}
+
+// Round trips through lzCompress/lzDecompress, and corrupt or truncated
+// input must be rejected rather than read past.
+bool selfTestCodec(const TextGenerator &text, const BenchConfig &config)
+{
+    mt19937_64 rng(config.seed);
+    vector<string> inputs{"", "a", "abcd", string(100000, 'x')};
+    for (size_t n : {10, 1000, 65535, 65536, 300000})
+    {
+        string words;
+        while (words.size() < n)
+        {
+            words += text.sentence(rng, 10, 40) + "\n";
+        }
+        words.resize(n);
+        inputs.push_back(words);
+        string noise(n, '\0');
+        for (char &c : noise)
+        {
+            c = static_cast<char>(rng());
+        }
+        inputs.push_back(noise);
+    }
+
+    bool ok = true;
+    for (const string &in : inputs)
+    {
+        string packed = lzCompress(in);
+        string out(in.size(), '\0');
+        string size = to_string(in.size()) + " bytes";
+        ok &= expect(lzDecompress(packed, out.data(), out.size()) && out == in, "codec round trip of " + size);
+        string longer(in.size() + 1, '\0');
+        ok &= expect(!lzDecompress(packed, longer.data(), longer.size()), "codec accepts a wrong size for " + size);
+        if (!packed.empty())
+        {
+            ok &= expect(!lzDecompress(string_view(packed).substr(0, packed.size() - 1), out.data(), out.size()),
+                         "codec accepts a truncated block of " + size);
+        }
+        // A flipped byte may still decode to something; it just must not
+        // write out of bounds (run under -fsanitize=address to see that).
+        for (int k = 0; k < 20 && !packed.empty(); ++k)
+        {
+            string bad = packed;
+            bad[rng() % bad.size()] ^= static_cast<char>(1 + rng() % 255);
+            lzDecompress(bad, out.data(), out.size());
+        }
+    }
+    printf("selftest codec: %zu inputs %s\n", inputs.size(), ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// One seeded round of writes, so two instances can be given the same history.
+void selfTestWrites(StackOverflow &so, size_t firstQuestion, size_t questions, size_t users, const TextGenerator &text, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    for (size_t i = firstQuestion; i < firstQuestion + questions; ++i)
+    {
+        QuestionHandle Q = so.addQuestion(rng() % users, text.sentence(rng, 20, 200));
+        so.addTag(Q, text.tag(rng));
+        QuestionHandle target = rng() % (i + 1);
+        AnswerHandle A = so.answerQuestion(rng() % users, target, text.sentence(rng, 10, 120));
+        so.addCommentOnQuestion(rng() % users, target, text.sentence(rng, 3, 20));
+        so.addCommentOnAnswer(rng() % users, target, A, text.sentence(rng, 3, 20));
+        so.addVoteOnQuestion(rng() % users, rng() % (i + 1), rng() % 4 ? voteType::Upvote : voteType::Downvote);
+        so.addVoteOnAnswer(rng() % users, A, rng() % 4 ? voteType::Upvote : voteType::Downvote);
+    }
+}
+
+// Value of the sample line starting with `series` in a metrics export.
+double metricValue(const string &metrics, const string &series)
+{
+    size_t at = metrics.find("\n" + series + " ");
+    return at == string::npos ? -1 : stod(metrics.substr(at + series.size() + 2));
+}
+
+// Writes to a durable instance with a small resident budget, checkpoints
+// half way, drops it without a final checkpoint and reopens it: every text,
+// score and reputation, and the search, find and duplicate results must
+// match an instance that only ever lived in memory.
+bool selfTestReopen(const TextGenerator &text, const BenchConfig &config)
+{
+    const size_t users = 200, half = 3000;
+    const size_t RESIDENT_BYTES = 1 << 20, CACHE_BYTES = 256 << 10;
+    string dir = (filesystem::temp_directory_path() / ("stackoverflow-selftest-" + to_string(::getpid()))).string();
+    filesystem::remove_all(dir);
+
+    StackOverflow memory;
+    auto durable = make_unique<StackOverflow>();
+    durable->setColdStorage(RESIDENT_BYTES, CACHE_BYTES);
+    bool ok = expect(durable->open(dir), "open " + dir);
+    for (size_t i = 0; i < users; ++i)
+    {
+        memory.createUser("user" + to_string(i), "Member " + to_string(i));
+        durable->createUser("user" + to_string(i), "Member " + to_string(i));
+    }
+    selfTestWrites(memory, 0, half, users, text, config.seed);
+    selfTestWrites(*durable, 0, half, users, text, config.seed);
+    ok &= expect(durable->checkpoint(), "checkpoint");
+    selfTestWrites(memory, half, half, users, text, config.seed + 1);
+    selfTestWrites(*durable, half, half, users, text, config.seed + 1);
+    durable->sync();
+    durable.reset();
+
+    StackOverflow reopened;
+    reopened.setColdStorage(RESIDENT_BYTES, CACHE_BYTES);
+    ok &= expect(reopened.open(dir), "reopen " + dir);
+    string metrics = reopened.exportMetrics();
+    ok &= expect(metricValue(metrics, "stackoverflow_cold_text_bytes{pool=\"question\"}") > 0, "question text went cold");
+
+    size_t mismatches = 0;
+    for (QuestionHandle Q = 0; Q < 2 * half && ok; ++Q)
+    {
+        const Question &a = memory.getQuestion(Q), &b = reopened.getQuestion(Q);
+        mismatches += memory.getQuestionText(Q) != reopened.getQuestionText(Q) || a.getUpvote() != b.getUpvote() ||
+                      a.getDownVote() != b.getDownVote() || a.getAnswers() != b.getAnswers() || a.getComments() != b.getComments();
+        for (AnswerHandle A : a.getAnswers())
+        {
+            mismatches += memory.getAnswerText(A) != reopened.getAnswerText(A) ||
+                          memory.getAnswer(A).getScore() != reopened.getAnswer(A).getScore();
+        }
+        for (CommentHandle C : a.getComments())
+        {
+            mismatches += memory.getCommentText(C) != reopened.getCommentText(C);
+        }
+    }
+    for (UserHandle U = 0; U < users; ++U)
+    {
+        mismatches += memory.getUser(U).getReputation() != reopened.getUser(U).getReputation();
+    }
+    ok &= expect(mismatches == 0, to_string(mismatches) + " posts or users differ after reopen");
+
+    // Finds scan every body, so they read the cold blocks; keys are cut from
+    // the oldest questions, which are the coldest.
+    mt19937_64 rng(config.seed + 2);
+    vector<string> keys{"no such text anywhere", text.word(rng)};
+    for (QuestionHandle Q : {0u, 1u, 17u, 2999u, 5999u})
+    {
+        string body(memory.getQuestionText(Q).view());
+        keys.push_back(body.substr(body.size() / 3, 24));
+    }
+    for (const string &key : keys)
+    {
+        vector<QuestionHandle> expected = memory.findQuestion(key);
+        ok &= expect(expected == reopened.findQuestion(key), "findQuestion(\"" + key + "\") over cold blocks");
+    }
+    for (int i = 0; i < 20; ++i)
+    {
+        string query = text.sentence(rng, 1, 3);
+        vector<ScoredDoc> expected = memory.searchQuestions(query), actual = reopened.searchQuestions(query);
+        ok &= expect(expected.size() == actual.size() &&
+                         equal(expected.begin(), expected.end(), actual.begin(), [](const ScoredDoc &x, const ScoredDoc &y)
+                               { return x.doc == y.doc; }),
+                     "searchQuestions(\"" + query + "\") after reopen");
+    }
+    for (QuestionHandle Q : {0u, 100u, 4000u})
+    {
+        vector<DuplicateMatch> expected = memory.findDuplicatesOf(Q), actual = reopened.findDuplicatesOf(Q);
+        ok &= expect(expected.size() == actual.size() &&
+                         equal(expected.begin(), expected.end(), actual.begin(), [](const DuplicateMatch &x, const DuplicateMatch &y)
+                               { return x.doc == y.doc; }),
+                     "findDuplicatesOf(" + to_string(Q) + ") after reopen");
+    }
+    ok &= expect(memory.getHotQuestions() == reopened.getHotQuestions(), "hot questions after reopen");
+
+    // A snapshot with one damaged byte must be refused, not parsed.
+    {
+        fstream snapshot(dir + "/snapshot", ios::in | ios::out | ios::binary);
+        snapshot.seekg(static_cast<streamoff>(filesystem::file_size(dir + "/snapshot") / 2));
+        char c = static_cast<char>(snapshot.peek());
+        snapshot.seekp(snapshot.tellg());
+        snapshot.put(static_cast<char>(c ^ 0x10));
+    }
+    StackOverflow damaged;
+    ok &= expect(!damaged.open(dir), "a damaged snapshot is refused");
+
+    printf("selftest reopen: %zu questions, %.0f KB of question text cold, %zu finds %s\n", 2 * half,
+           metricValue(metrics, "stackoverflow_cold_text_bytes{pool=\"question\"}") / 1024, keys.size(), ok ? "ok" : "FAILED");
+    filesystem::remove_all(dir);
+    return ok;
+}
+
+// A five-post dump with the awkward cases: the Community user (Id -1),
+// ownerless posts, an owner missing from Users.xml, an answer to a question
+// that is not in the dump and a user whose "user<Id>" name is already held by
+// a live account. Importing it twice, across a reopen, must not duplicate
+// anything or move posts between accounts.
+bool selfTestImport(const BenchConfig &config)
+{
+    string dir = (filesystem::temp_directory_path() / ("stackoverflow-import-" + to_string(::getpid()))).string();
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir + "/dump");
+    const pair<const char *, const char *> files[] = {
+        {"Users.xml", "<users>\n"
+                      "  <row Id=\"-1\" DisplayName=\"Community\" />\n"
+                      "  <row Id=\"1\" DisplayName=\"Alice\" />\n"
+                      "</users>\n"},
+        {"Posts.xml", "<posts>\n"
+                      "  <row Id=\"10\" PostTypeId=\"1\" OwnerUserId=\"1\" Title=\"How to sort\" Body=\"&lt;p&gt;a vector&lt;/p&gt;\" Tags=\"&lt;c++&gt;\" />\n"
+                      "  <row Id=\"11\" PostTypeId=\"2\" ParentId=\"10\" OwnerUserId=\"-1\" Body=\"use sort\" />\n"
+                      "  <row Id=\"12\" PostTypeId=\"2\" ParentId=\"10\" Body=\"ownerless\" />\n"
+                      "  <row Id=\"13\" PostTypeId=\"2\" ParentId=\"10\" OwnerUserId=\"77\" Body=\"deleted owner\" />\n"
+                      "  <row Id=\"14\" PostTypeId=\"2\" ParentId=\"99\" OwnerUserId=\"1\" Body=\"no question\" />\n"
+                      "</posts>\n"},
+        {"Comments.xml", "<comments>\n"
+                         "  <row Id=\"1\" PostId=\"10\" Text=\"anonymous\" />\n"
+                         "  <row Id=\"2\" PostId=\"11\" UserId=\"1\" Text=\"thanks\" />\n"
+                         "</comments>\n"},
+        {"Votes.xml", "<votes>\n"
+                      "  <row Id=\"1\" PostId=\"10\" VoteTypeId=\"2\" />\n"
+                      "  <row Id=\"2\" PostId=\"11\" VoteTypeId=\"3\" />\n"
+                      "  <row Id=\"3\" PostId=\"99\" VoteTypeId=\"2\" />\n"
+                      "</votes>\n"}};
+    for (const auto &[name, content] : files)
+    {
+        ofstream(dir + "/dump/" + name) << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" << content;
+    }
+
+    bool ok = true;
+    auto owned = [&](const StackOverflow &so, const string &uname, const string &name, size_t questions, size_t answers, size_t comments)
+    {
+        UserHandle U = so.findUser(uname);
+        if (!expect(U != INVALID_HANDLE, "imported user " + uname + " exists"))
+        {
+            return false;
+        }
+        const User &user = so.getUser(U);
+        return expect(user.getName() == name && user.getQuestions().size() == questions && user.getAnswers().size() == answers &&
+                          user.getComments().size() == comments,
+                      uname + " owns the right posts");
+    };
+    {
+        StackOverflow so;
+        ok &= expect(so.open(dir + "/store"), "open " + dir + "/store");
+        UserHandle live = so.createUser("user1", "preexisting");
+        ImportStats stats = so.importDump(dir + "/dump", max(1u, config.threads.front()));
+        ok &= expect(stats.users == 2 && stats.questions == 1 && stats.answers == 3 && stats.comments == 2 && stats.votes == 2 && stats.skipped == 2,
+                     "import counts");
+        ok &= owned(so, "user1", "preexisting", 0, 0, 0) && expect(so.getUser(live).getReputation() == 0, "live user1 keeps its reputation");
+        ok &= owned(so, "user1-2", "Alice", 1, 0, 1) && expect(so.getUser(so.findUser("user1-2")).getReputation() > 0, "dump user 1 earns reputation");
+        ok &= owned(so, "user-1", "Community", 0, 1, 0);
+        ok &= owned(so, "[deleted]", "deleted user", 0, 2, 1);
+    }
+    {
+        StackOverflow so;
+        ok &= expect(so.open(dir + "/store"), "reopen " + dir + "/store");
+        ImportStats again = so.importDump(dir + "/dump", max(1u, config.threads.front()));
+        ok &= expect(again.users == 0 && again.questions == 0 && again.answers == 0 && again.comments == 0 && again.votes == 0,
+                     "repeat import after reopen adds nothing");
+        ok &= expect(so.findUser("user1-3") == INVALID_HANDLE, "repeat import creates no second account");
+        ok &= owned(so, "user1-2", "Alice", 1, 0, 1) && owned(so, "user-1", "Community", 0, 1, 0) && owned(so, "user1", "preexisting", 0, 0, 0);
+    }
+    printf("selftest import: %s\n", ok ? "ok" : "FAILED");
+    filesystem::remove_all(dir);
+    return ok;
+}
+
+// The same history applied through a WritePipeline, whose batches coalesce
+// vote toggles, and one call at a time must end in the same votes, scores,
+// answer order and reputation. Votes go to a few posts from a few users, so
+// one batch often holds several toggles by the same voter on the same post.
+// Then several threads submit with done callbacks: after flush() each must
+// have seen all of its callbacks.
+bool selfTestPipeline(const TextGenerator &text, const BenchConfig &config)
+{
+    const size_t users = 40, questions = 30, calls = 40000;
+    StackOverflow direct, batched;
+    mt19937_64 setup(config.seed);
+    for (size_t i = 0; i < users; ++i)
+    {
+        direct.createUser("user" + to_string(i), "Member " + to_string(i));
+        batched.createUser("user" + to_string(i), "Member " + to_string(i));
+    }
+    for (size_t i = 0; i < questions; ++i)
+    {
+        string question = text.sentence(setup, 5, 20), answer = text.sentence(setup, 5, 20);
+        direct.answerQuestion(i % users, direct.addQuestion(i % users, question), answer);
+        batched.answerQuestion(i % users, batched.addQuestion(i % users, question), answer);
+    }
+
+    bool ok = true;
+    uint64_t batches = 0;
+    {
+        WritePipeline pipeline(batched);
+        mt19937_64 rng(config.seed + 1);
+        size_t answers = questions;
+        for (size_t i = 0; i < calls; ++i)
+        {
+            // Voters and posts come from small hot sets.
+            UserHandle U = rng() % 5;
+            QuestionHandle Q = rng() % 4;
+            voteType V = rng() % 3 ? voteType::Upvote : voteType::Downvote;
+            switch (rng() % 8)
+            {
+            case 0:
+            {
+                // New answers land in the same batches as votes on them.
+                UserHandle author = rng() % users;
+                string answer = text.sentence(rng, 3, 10);
+                direct.answerQuestion(author, Q, answer);
+                pipeline.answerQuestion(author, Q, answer);
+                answers++;
+                break;
+            }
+            case 1:
+            case 2:
+            case 3:
+                direct.addVoteOnQuestion(U, Q, V);
+                pipeline.addVoteOnQuestion(U, Q, V);
+                break;
+            default:
+            {
+                AnswerHandle A = rng() % 2 ? rng() % 4 : answers - 1 - rng() % 3;
+                direct.addVoteOnAnswer(U, A, V);
+                pipeline.addVoteOnAnswer(U, A, V);
+                break;
+            }
+            }
+        }
+        pipeline.flush();
+        batches = pipeline.publishedVersion();
+    }
+
+    size_t mismatches = 0;
+    for (QuestionHandle Q = 0; Q < questions; ++Q)
+    {
+        const Question &a = direct.getQuestion(Q), &b = batched.getQuestion(Q);
+        mismatches += a.getUpvote() != b.getUpvote() || a.getDownVote() != b.getDownVote();
+        Slice<AnswerHandle> ranked = a.getTopAnswers(0, SIZE_MAX), other = b.getTopAnswers(0, SIZE_MAX);
+        mismatches += !equal(ranked.begin(), ranked.end(), other.begin(), other.end());
+        for (AnswerHandle A : ranked)
+        {
+            mismatches += direct.getAnswer(A).getScore() != batched.getAnswer(A).getScore();
+        }
+    }
+    for (UserHandle U = 0; U < users; ++U)
+    {
+        mismatches += direct.getUser(U).getReputation() != batched.getUser(U).getReputation();
+    }
+    ok &= expect(mismatches == 0, to_string(mismatches) + " posts or users differ between batched and direct calls");
+
+    const unsigned threads = 4;
+    const size_t perThread = 200;
+    vector<size_t> seen(threads, 0);
+    vector<char> complete(threads, 0);
+    {
+        WritePipeline pipeline(batched);
+        vector<thread> submitters;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            submitters.emplace_back([&, t]
+                                    {
+                                        for (size_t i = 0; i < perThread; ++i)
+                                        {
+                                            pipeline.addQuestion(t, "question " + to_string(i), [&seen, t](Handle)
+                                                                 { seen[t]++; });
+                                        }
+                                        pipeline.flush();
+                                        complete[t] = seen[t] == perThread; });
+        }
+        for (thread &submitter : submitters)
+        {
+            submitter.join();
+        }
+    }
+    ok &= expect(count(complete.begin(), complete.end(), 1) == threads, "flush() returns after the done callbacks");
+
+    printf("selftest pipeline: %zu calls in %lu batches against direct calls, %u threads flushing: %s\n", calls, (unsigned long)batches, threads,
+           ok ? "ok" : "FAILED");
+    return ok;
+}
+
+bool selfTest(const TextGenerator &text, const BenchConfig &config)
+{
+    bool codec = selfTestCodec(text, config);
+    bool reopen = selfTestReopen(text, config);
+    bool import = selfTestImport(config);
+    bool pipeline = selfTestPipeline(text, config);
+    return codec && reopen && import && pipeline;
+}
+
+template <typename T>
+vector<T> parseList(const string &value)
+{
+    vector<T> result;
+    stringstream in(value);
+    string item;
+    while (getline(in, item, ','))
+    {
+        result.push_back(static_cast<T>(stoull(item)));
+    }
+    return result;
+}
+
+bool parseArgs(int argc, char **argv, BenchConfig &config)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        string key = arg.substr(0, eq);
+        string value = eq == string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--sizes")
+            config.sizes = parseList<size_t>(value);
+        else if (key == "--threads")
+            config.threads = parseList<unsigned>(value);
+        else if (key == "--ops")
+            config.ops = stoull(value);
+        else if (key == "--skew")
+            config.skew = stod(value);
+        else if (key == "--seed")
+            config.seed = stoull(value);
+        else if (key == "--pipeline")
+            config.pipeline = true;
+        else if (key == "--metrics")
+            config.metrics = true;
+        else if (key == "--selftest")
+            config.selfTest = true;
+        else if (key == "--mix")
+        {
+            config.mix.fill(0);
+            stringstream in(value);
+            string item;
+            while (getline(in, item, ','))
+            {
+                size_t colon = item.find(':');
+                auto name = find(begin(OP_NAMES), end(OP_NAMES), item.substr(0, colon));
+                if (colon == string::npos || name == end(OP_NAMES))
+                {
+                    cout << "Unknown operation in --mix: " << item << endl;
+                    return false;
+                }
+                config.mix[name - begin(OP_NAMES)] = stod(item.substr(colon + 1));
+            }
+        }
+        else
+        {
+            cout << "usage: " << argv[0] << " [--sizes=N,N] [--threads=T,T] [--ops=N] [--skew=S] [--seed=N] [--pipeline] [--metrics] [--selftest]"
+                 << " [--mix=search:W,view:W,vote:W,answer:W,comment:W,find:W]" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config))
+    {
+        return 1;
+    }
+    TextGenerator text(50000, 2000, config.skew, config.seed);
+    if (config.selfTest)
+    {
+        return selfTest(text, config) ? 0 : 1;
+    }
+    for (size_t size : config.sizes)
+    {
+        StackOverflow so;
+        buildCorpus(so, size, text, config);
+        for (unsigned threads : config.threads)
+        {
+            vector<LatencyStats> stats;
+            double seconds = runMix(so, size, max(1u, threads), text, config, stats);
+            report(max(1u, threads), seconds, stats);
+            if (config.mix[static_cast<size_t>(Op::Find)] > 0)
+            {
+                QueryCacheStats cache = so.getFindCacheStats();
+                printf("    find cache so far: %lu hits, %lu misses, %lu evictions, %lu invalidations, %zu entries, %zu KB\n",
+                       (unsigned long)cache.hits, (unsigned long)cache.misses, (unsigned long)cache.evictions,
+                       (unsigned long)cache.invalidations, cache.entries, cache.bytes >> 10);
+            }
+        }
+        if (config.metrics)
+        {
+            fputs(so.exportMetrics().c_str(), stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Parallel.h"
+
+// Helpers for reading Stack Exchange data dumps (Users.xml, Posts.xml,
+// Comments.xml, Votes.xml). Each dump is one `<row attr="value" ... />`
+// element per line, so files can be cut at line ends and the pieces parsed
+// independently.
+
+// Reads a file in blocks of roughly CHUNK_BYTES that always end on a line
+// boundary, so memory stays bounded however large the dump is.
+class ChunkedFileReader
+{
+private:
+    static constexpr std::size_t CHUNK_BYTES = 64 << 20;
+
+    std::FILE *file = nullptr;
+    std::string carry;
+
+public:
+    ChunkedFileReader(const ChunkedFileReader &) = delete;
+    ChunkedFileReader &operator=(const ChunkedFileReader &) = delete;
+
+    explicit ChunkedFileReader(const std::string &path)
+    {
+        file = std::fopen(path.c_str(), "rb");
+    }
+
+    ~ChunkedFileReader()
+    {
+        if (file != nullptr)
+        {
+            std::fclose(file);
+        }
+    }
+
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+
+    // Fills chunk with the next run of whole lines; false at end of file.
+    bool next(std::string &chunk)
+    {
+        chunk.swap(carry);
+        carry.clear();
+        if (file == nullptr)
+        {
+            return !chunk.empty();
+        }
+        std::size_t old = chunk.size();
+        chunk.resize(old + CHUNK_BYTES);
+        std::size_t got = std::fread(&chunk[old], 1, CHUNK_BYTES, file);
+        chunk.resize(old + got);
+        if (got < CHUNK_BYTES)
+        {
+            std::fclose(file);
+            file = nullptr;
+            return !chunk.empty();
+        }
+        std::size_t lastNewline = chunk.rfind('\n');
+        if (lastNewline != std::string::npos)
+        {
+            carry.assign(chunk, lastNewline + 1, std::string::npos);
+            chunk.resize(lastNewline + 1);
+        }
+        return true;
+    }
+};
+
+// Attributes of one `<row .../>` line. Values are raw (still XML-escaped)
+// views into the line.
+class XmlRow
+{
+private:
+    std::vector<std::pair<std::string_view, std::string_view>> attrs;
+
+public:
+    // False if the line is not a row element (e.g. the XML prolog).
+    bool parse(std::string_view line)
+    {
+        attrs.clear();
+        std::size_t pos = line.find("<row ");
+        if (pos == std::string_view::npos)
+        {
+            return false;
+        }
+        pos += 5;
+        while (true)
+        {
+            std::size_t eq = line.find("=\"", pos);
+            if (eq == std::string_view::npos)
+            {
+                break;
+            }
+            std::size_t nameStart = line.find_last_of(' ', eq);
+            std::size_t close = line.find('"', eq + 2);
+            if (nameStart == std::string_view::npos || close == std::string_view::npos)
+            {
+                break;
+            }
+            attrs.emplace_back(line.substr(nameStart + 1, eq - nameStart - 1), line.substr(eq + 2, close - eq - 2));
+            pos = close + 1;
+        }
+        return true;
+    }
+
+    std::string_view get(std::string_view name) const
+    {
+        for (auto &attr : attrs)
+        {
+            if (attr.first == name)
+            {
+                return attr.second;
+            }
+        }
+        return std::string_view();
+    }
+
+    std::int64_t getInt(std::string_view name, std::int64_t fallback = -1) const
+    {
+        std::string_view v = get(name);
+        if (v.empty())
+        {
+            return fallback;
+        }
+        bool negative = v[0] == '-';
+        std::int64_t n = 0;
+        for (std::size_t i = negative ? 1 : 0; i < v.size() && v[i] >= '0' && v[i] <= '9'; ++i)
+        {
+            n = n * 10 + (v[i] - '0');
+        }
+        return negative ? -n : n;
+    }
+};
+
+// Resolves the entities the dumps use (&lt; &gt; &amp; &quot; &apos; and
+// numeric ones such as &#xA;) and appends the result to out.
+inline void appendXmlDecoded(std::string_view raw, std::string &out)
+{
+    for (std::size_t i = 0; i < raw.size(); ++i)
+    {
+        if (raw[i] != '&')
+        {
+            out.push_back(raw[i]);
+            continue;
+        }
+        std::size_t semi = raw.find(';', i);
+        if (semi == std::string_view::npos || semi - i > 10)
+        {
+            out.push_back('&');
+            continue;
+        }
+        std::string_view entity = raw.substr(i + 1, semi - i - 1);
+        if (entity == "lt")
+            out.push_back('<');
+        else if (entity == "gt")
+            out.push_back('>');
+        else if (entity == "amp")
+            out.push_back('&');
+        else if (entity == "quot")
+            out.push_back('"');
+        else if (entity == "apos")
+            out.push_back('\'');
+        else if (!entity.empty() && entity[0] == '#')
+        {
+            bool hex = entity.size() > 1 && (entity[1] == 'x' || entity[1] == 'X');
+            unsigned long code = std::strtoul(std::string(entity.substr(hex ? 2 : 1)).c_str(), nullptr, hex ? 16 : 10);
+            // Post bodies are searched as bytes; anything beyond ASCII is
+            // kept only as a separator.
+            out.push_back(code < 128 ? static_cast<char>(code) : ' ');
+        }
+        else
+        {
+            out.append(raw.substr(i, semi - i + 1));
+        }
+        i = semi;
+    }
+}
+
+// Drops HTML markup from a decoded post body, leaving the text content.
+inline std::string stripHtml(std::string_view html)
+{
+    std::string text;
+    text.reserve(html.size());
+    bool inTag = false;
+    for (char c : html)
+    {
+        if (c == '<')
+        {
+            inTag = true;
+        }
+        else if (c == '>' && inTag)
+        {
+            inTag = false;
+            text.push_back(' ');
+        }
+        else if (!inTag)
+        {
+            text.push_back(c);
+        }
+    }
+    return text;
+}
+
+// Tag lists come as "<c++><stl>" in older dumps and "|c++|stl|" in newer.
+inline std::vector<std::string> splitDumpTags(std::string_view decoded)
+{
+    std::vector<std::string> result;
+    std::string current;
+    for (char c : decoded)
+    {
+        if (c == '<' || c == '>' || c == '|')
+        {
+            if (!current.empty())
+            {
+                result.push_back(std::move(current));
+                current.clear();
+            }
+        }
+        else
+        {
+            current.push_back(c);
+        }
+    }
+    if (!current.empty())
+    {
+        result.push_back(std::move(current));
+    }
+    return result;
+}
+
+// "2008-07-31T21:42:52.667" (UTC) to seconds since the Unix epoch.
+inline double parseDumpTime(std::string_view iso)
+{
+    std::tm tm{};
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0;
+    double second = 0;
+    if (std::sscanf(std::string(iso).c_str(), "%d-%d-%dT%d:%d:%lf", &year, &month, &day, &hour, &minute, &second) < 3)
+    {
+        return 0;
+    }
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    return static_cast<double>(timegm(&tm)) + second;
+}
+
+// Parses every row of chunk on `threads` threads. parseRow(const XmlRow &,
+// std::vector<Item> &) appends zero or more items per row; the per-thread
+// results are concatenated in file order.
+template <typename Item, typename ParseFn>
+std::vector<Item> parseRowsParallel(std::string_view chunk, unsigned threads, ParseFn parseRow)
+{
+    threads = std::max(1u, threads);
+    std::vector<std::pair<std::size_t, std::size_t>> ranges;
+    std::size_t begin = 0;
+    for (unsigned t = 0; t < threads && begin < chunk.size(); ++t)
+    {
+        std::size_t end = t + 1 == threads ? chunk.size() : std::min(chunk.size(), begin + chunk.size() / threads);
+        std::size_t newline = chunk.find('\n', end);
+        end = newline == std::string_view::npos ? chunk.size() : newline + 1;
+        ranges.emplace_back(begin, end);
+        begin = end;
+    }
+
+    if (ranges.empty())
+    {
+        return std::vector<Item>();
+    }
+
+    std::vector<std::vector<Item>> parts(ranges.size());
+    onThreads(static_cast<unsigned>(ranges.size()), [&](unsigned t)
+              {
+                  XmlRow row;
+                  std::size_t pos = ranges[t].first;
+                  while (pos < ranges[t].second)
+                  {
+                      std::size_t eol = chunk.find('\n', pos);
+                      if (eol == std::string_view::npos || eol > ranges[t].second)
+                      {
+                          eol = ranges[t].second;
+                      }
+                      if (row.parse(chunk.substr(pos, eol - pos)))
+                      {
+                          parseRow(row, parts[t]);
+                      }
+                      pos = eol + 1;
+                  } });
+
+    std::vector<Item> merged = std::move(parts[0]);
+    for (std::size_t t = 1; t < parts.size(); ++t)
+    {
+        std::move(parts[t].begin(), parts[t].end(), std::back_inserter(merged));
+    }
+    return merged;
+}
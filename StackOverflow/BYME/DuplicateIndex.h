@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "Arena.h"
+#include "Parallel.h"
+#include "SearchIndex.h"
+#include "Storage.h"
+
+struct DuplicateMatch
+{
+    Handle doc;
+    double similarity; // estimated Jaccard similarity of the shingle sets
+};
+
+// Near-duplicate detection with MinHash and locality-sensitive hashing.
+//
+// A text becomes the set of its word 3-grams (shingles, over the search
+// tokenizer's terms). Its signature keeps, for each of HASHES hash
+// functions, the minimum hash over that set; two signatures agree in a
+// position with probability equal to the sets' Jaccard similarity. The
+// signature is cut into BANDS bands of ROWS values, and a document is filed
+// in one bucket per band. Candidates are the documents sharing any bucket
+// with the query, so a lookup touches a handful of buckets rather than the
+// whole corpus; with 16 bands of 4 rows, pairs at similarity 0.5 collide
+// about 64% of the time and pairs at 0.8 over 99%.
+//
+// Each band is a flat open-addressing table from a 32-bit bucket key to the
+// newest document in the bucket; older ones are chained through the band's
+// `next` array, so a bucket needs no allocation of its own. Two buckets whose keys clash in 32
+// bits merge, which only adds candidates that the signature comparison then
+// rejects. Signatures are saved with the snapshot, so a restart refiles them
+// instead of tokenising every text again.
+class DuplicateIndex
+{
+public:
+    static constexpr std::size_t BANDS = 16;
+    static constexpr std::size_t ROWS = 4;
+    static constexpr std::size_t HASHES = BANDS * ROWS;
+
+private:
+    using Signature = std::array<std::uint32_t, HASHES>;
+
+    struct BandTable
+    {
+        std::vector<std::uint32_t> keys;
+        std::vector<Handle> heads; // INVALID_HANDLE marks an empty slot
+        std::vector<Handle> next;  // per document: the older one in its bucket
+        std::size_t used = 0;
+    };
+
+    std::vector<std::uint32_t> signatures; // HASHES per document
+    std::vector<char> present;
+    BandTable bands[BANDS];
+
+    static std::uint64_t mix(std::uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    // Returns false for texts without a single term.
+    static bool computeSignature(std::string_view text, Signature &sig)
+    {
+        std::vector<std::uint64_t> terms;
+        forEachTerm(text, [&](std::string_view term)
+                    { terms.push_back(std::hash<std::string_view>()(term)); });
+        if (terms.empty())
+        {
+            return false;
+        }
+        std::vector<std::uint64_t> shingles;
+        std::size_t width = std::min<std::size_t>(3, terms.size());
+        for (std::size_t i = 0; i + width <= terms.size(); ++i)
+        {
+            std::uint64_t h = 0;
+            for (std::size_t j = 0; j < width; ++j)
+            {
+                h = mix(h ^ terms[i + j]);
+            }
+            shingles.push_back(h);
+        }
+        std::sort(shingles.begin(), shingles.end());
+        shingles.erase(std::unique(shingles.begin(), shingles.end()), shingles.end());
+
+        // The HASHES functions are derived from one shingle hash by double
+        // hashing, h_i = a + i * b, so a shingle costs one multiply-add per
+        // function rather than a full mixing round.
+        sig.fill(UINT32_MAX);
+        for (std::uint64_t s : shingles)
+        {
+            std::uint32_t a = static_cast<std::uint32_t>(s);
+            std::uint32_t b = static_cast<std::uint32_t>(s >> 32) | 1;
+            for (std::size_t i = 0; i < HASHES; ++i)
+            {
+                sig[i] = std::min(sig[i], a + static_cast<std::uint32_t>(i) * b);
+            }
+        }
+        return true;
+    }
+
+    static std::uint32_t bandKey(const std::uint32_t *sig, std::size_t band)
+    {
+        const std::uint32_t *rows = sig + band * ROWS;
+        std::uint64_t h = mix((static_cast<std::uint64_t>(rows[0]) << 32 | rows[1]) ^ band);
+        h = mix(h ^ (static_cast<std::uint64_t>(rows[2]) << 32 | rows[3]));
+        return static_cast<std::uint32_t>(h >> 32);
+    }
+
+    // The slot holding key, or the empty slot where it would go.
+    static std::size_t slotOf(const BandTable &table, std::uint32_t key)
+    {
+        std::size_t mask = table.heads.size() - 1;
+        std::size_t slot = key & mask;
+        while (table.heads[slot] != INVALID_HANDLE && table.keys[slot] != key)
+        {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    // Rehashes into at least `slots` slots (a power of two).
+    static void resize(BandTable &table, std::size_t slots)
+    {
+        std::size_t size = 64;
+        while (size < slots)
+        {
+            size *= 2;
+        }
+        BandTable grown;
+        grown.keys.resize(size);
+        grown.heads.assign(size, INVALID_HANDLE);
+        grown.next = std::move(table.next);
+        grown.used = table.used;
+        for (std::size_t i = 0; i < table.heads.size(); ++i)
+        {
+            if (table.heads[i] != INVALID_HANDLE)
+            {
+                std::size_t slot = slotOf(grown, table.keys[i]);
+                grown.keys[slot] = table.keys[i];
+                grown.heads[slot] = table.heads[i];
+            }
+        }
+        table = std::move(grown);
+    }
+
+    // Caller has sized table.next past doc.
+    static void fileKey(BandTable &table, std::uint32_t key, Handle doc)
+    {
+        if ((table.used + 1) * 4 > table.heads.size() * 3)
+        {
+            resize(table, table.heads.size() * 2);
+        }
+        std::size_t slot = slotOf(table, key);
+        if (table.heads[slot] == INVALID_HANDLE)
+        {
+            table.keys[slot] = key;
+            table.used++;
+        }
+        table.next[doc] = table.heads[slot];
+        table.heads[slot] = doc;
+    }
+
+    void file(Handle doc, const Signature &sig)
+    {
+        if (doc >= present.size())
+        {
+            present.resize(doc + 1, 0);
+            signatures.resize(static_cast<std::size_t>(doc + 1) * HASHES, 0);
+        }
+        if (present[doc])
+        {
+            return;
+        }
+        std::copy(sig.begin(), sig.end(), signatures.begin() + static_cast<std::size_t>(doc) * HASHES);
+        present[doc] = 1;
+        for (std::size_t band = 0; band < BANDS; ++band)
+        {
+            if (bands[band].next.size() <= doc)
+            {
+                bands[band].next.resize(std::max<std::size_t>(doc + 1, bands[band].next.size() * 2), INVALID_HANDLE);
+            }
+            fileKey(bands[band], bandKey(sig.data(), band), doc);
+        }
+    }
+
+    std::vector<DuplicateMatch> match(const Signature &sig, Handle self, double minSimilarity, std::size_t k) const
+    {
+        std::unordered_set<Handle> seen;
+        std::vector<DuplicateMatch> result;
+        for (std::size_t band = 0; band < BANDS; ++band)
+        {
+            const BandTable &table = bands[band];
+            if (table.heads.empty())
+            {
+                continue;
+            }
+            Handle head = table.heads[slotOf(table, bandKey(sig.data(), band))];
+            for (Handle doc = head; doc != INVALID_HANDLE; doc = table.next[doc])
+            {
+                if (doc == self || !seen.insert(doc).second)
+                {
+                    continue;
+                }
+                const std::uint32_t *other = signatures.data() + static_cast<std::size_t>(doc) * HASHES;
+                std::size_t agree = 0;
+                for (std::size_t i = 0; i < HASHES; ++i)
+                {
+                    agree += sig[i] == other[i];
+                }
+                double similarity = static_cast<double>(agree) / HASHES;
+                if (similarity >= minSimilarity)
+                {
+                    result.push_back({doc, similarity});
+                }
+            }
+        }
+        std::sort(result.begin(), result.end(), [](const DuplicateMatch &a, const DuplicateMatch &b)
+                  { return a.similarity != b.similarity ? a.similarity > b.similarity : a.doc < b.doc; });
+        if (result.size() > k)
+        {
+            result.resize(k);
+        }
+        return result;
+    }
+
+public:
+    void addDocument(Handle doc, std::string_view text)
+    {
+        Signature sig;
+        if (computeSignature(text, sig))
+        {
+            file(doc, sig);
+        }
+    }
+
+    // Bulk form for imports and snapshot loads: signatures for docs
+    // first, first + 1, ... are computed on `threads` threads, then filed.
+    void addDocuments(Handle first, const std::vector<std::string_view> &texts, unsigned threads)
+    {
+        threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(std::max<std::size_t>(1, texts.size()))));
+        std::vector<Signature> sigs(texts.size());
+        std::vector<char> ok(texts.size());
+        parallelRanges(texts.size(), threads, [&](std::size_t begin, std::size_t end)
+                       {
+                           for (std::size_t i = begin; i < end; ++i)
+                           {
+                               ok[i] = computeSignature(texts[i], sigs[i]);
+                           } });
+        for (std::size_t i = 0; i < texts.size(); ++i)
+        {
+            if (ok[i])
+            {
+                file(first + static_cast<Handle>(i), sigs[i]);
+            }
+        }
+    }
+
+    // Heap footprint: signatures, band tables and bucket chains.
+    std::size_t memoryBytes() const
+    {
+        std::size_t total = ownedBytes(signatures) + ownedBytes(present);
+        for (const BandTable &table : bands)
+        {
+            total += ownedBytes(table.keys) + ownedBytes(table.heads) + ownedBytes(table.next);
+        }
+        return total;
+    }
+
+    void save(BinaryWriter &out) const
+    {
+        out.put<std::uint64_t>(present.size());
+        out.putBytes(present.data(), present.size());
+        out.putBytes(signatures.data(), signatures.size() * sizeof(std::uint32_t));
+    }
+
+    // Restores the signatures and refiles them. Bucket keys for every band
+    // are computed in one pass over the signatures; the bands are then
+    // filled one per thread at a time, prefetching table slots ahead. Fails
+    // if the index covers more than docLimit documents.
+    bool load(BinaryReader &in, std::size_t docLimit, unsigned threads)
+    {
+        std::uint64_t docs = in.get<std::uint64_t>();
+        const void *flags = in.getBytes(docs);
+        const void *sigs = in.getBytes(docs * HASHES * sizeof(std::uint32_t));
+        if (in.failed() || docs > docLimit)
+        {
+            return false;
+        }
+        present.assign(static_cast<const char *>(flags), static_cast<const char *>(flags) + docs);
+        signatures.resize(docs * HASHES);
+        std::memcpy(signatures.data(), sigs, signatures.size() * sizeof(std::uint32_t));
+        std::vector<Handle> filed;
+        for (Handle doc = 0; doc < docs; ++doc)
+        {
+            if (present[doc])
+            {
+                filed.push_back(doc);
+            }
+        }
+        constexpr std::size_t AHEAD = 16;
+        std::size_t n = filed.size();
+        std::vector<std::uint32_t> keys(n * BANDS); // band-major
+        parallelRanges(n, threads, [&](std::size_t begin, std::size_t end)
+                       {
+                           for (std::size_t i = begin; i < end; ++i)
+                           {
+                               const std::uint32_t *sig = signatures.data() + static_cast<std::size_t>(filed[i]) * HASHES;
+                               for (std::size_t band = 0; band < BANDS; ++band)
+                               {
+                                   keys[band * n + i] = bandKey(sig, band);
+                               }
+                           } });
+        threads = std::max(1u, std::min<unsigned>(threads, BANDS));
+        onThreads(threads, [&](unsigned t)
+                  {
+                      for (std::size_t band = t; band < BANDS; band += threads)
+                      {
+                          BandTable &table = bands[band];
+                          table = BandTable();
+                          table.next.assign(docs, INVALID_HANDLE);
+                          resize(table, n * 4 / 3 + 1);
+                          const std::uint32_t *bandKeys = keys.data() + band * n;
+                          std::size_t mask = table.heads.size() - 1;
+                          for (std::size_t i = 0; i < n; ++i)
+                          {
+                              if (i + AHEAD < n)
+                              {
+                                  __builtin_prefetch(&table.keys[bandKeys[i + AHEAD] & mask]);
+                                  __builtin_prefetch(&table.heads[bandKeys[i + AHEAD] & mask]);
+                              }
+                              fileKey(table, bandKeys[i], filed[i]);
+                          }
+                      } });
+        return true;
+    }
+
+    // Indexed documents resembling text, most similar first.
+    std::vector<DuplicateMatch> similarTo(std::string_view text, double minSimilarity, std::size_t k) const
+    {
+        Signature sig;
+        if (!computeSignature(text, sig))
+        {
+            return {};
+        }
+        return match(sig, INVALID_HANDLE, minSimilarity, k);
+    }
+
+    // Same for an indexed document, leaving out the document itself.
+    std::vector<DuplicateMatch> similarTo(Handle doc, double minSimilarity, std::size_t k) const
+    {
+        if (doc >= present.size() || !present[doc])
+        {
+            return {};
+        }
+        Signature sig;
+        std::copy_n(signatures.begin() + static_cast<std::size_t>(doc) * HASHES, HASHES, sig.begin());
+        return match(sig, doc, minSimilarity, k);
+    }
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <utility>
+#include <vector>
+#include "Arena.h"
+#include "Storage.h"
+
+// Trending items by exponentially time-decayed activity. An event of weight
+// w at time t adds w * 2^((t - base) / halfLife); every item decays by the
+// same factor, so this stored value orders items exactly like their decayed
+// scores and nothing has to be rescored as time passes. Once exponents grow
+// large the scores are rescaled to a new base (order preserving, so cheap).
+//
+// The best `capacity + slack` items sit in an ordered set. Every item
+// outside the set scores at most `outsideMax` and every member at least
+// that, so the first `capacity` members are the true top list. Only when
+// decreases push enough members out does the set get rebuilt from scratch.
+class HotFeed
+{
+private:
+    static constexpr double RESCALE_AFTER_HALF_LIVES = 64;
+    static constexpr double NEG_INF = -std::numeric_limits<double>::infinity();
+
+    std::size_t capacity;
+    std::size_t slack;
+    double halfLife;
+    double base = 0;
+    bool started = false;
+
+    std::vector<double> scores;
+    std::vector<bool> tracked; // item has had an event
+    std::vector<bool> inTop;
+    std::set<std::pair<double, Handle>, std::greater<>> top;
+    double outsideMax = NEG_INF;
+    std::size_t trackedCount = 0;
+
+    void rescale(double now)
+    {
+        double factor = std::exp2(-(now - base) / halfLife);
+        for (double &s : scores)
+        {
+            s *= factor;
+        }
+        std::set<std::pair<double, Handle>, std::greater<>> scaled;
+        for (auto &entry : top)
+        {
+            scaled.emplace(entry.first * factor, entry.second);
+        }
+        top = std::move(scaled);
+        if (outsideMax != NEG_INF)
+        {
+            outsideMax *= factor;
+        }
+        base = now;
+    }
+
+    void rebuild()
+    {
+        std::vector<std::pair<double, Handle>> all;
+        for (Handle h = 0; h < scores.size(); ++h)
+        {
+            if (tracked[h])
+            {
+                all.emplace_back(scores[h], h);
+            }
+            inTop[h] = false;
+        }
+        std::size_t keep = std::min(all.size(), capacity + slack);
+        std::nth_element(all.begin(), all.begin() + keep - (keep > 0), all.end(), std::greater<>());
+        top.clear();
+        for (std::size_t i = 0; i < keep; ++i)
+        {
+            top.insert(all[i]);
+            inTop[all[i].second] = true;
+        }
+        outsideMax = NEG_INF;
+        for (std::size_t i = keep; i < all.size(); ++i)
+        {
+            outsideMax = std::max(outsideMax, all[i].first);
+        }
+    }
+
+public:
+    HotFeed(std::size_t capacity = 100, double halfLifeSeconds = 6 * 3600.0)
+        : capacity(capacity), slack(capacity), halfLife(halfLifeSeconds) {}
+
+    // Adds an event of the given weight for item h at time now (seconds).
+    // Times should be roughly non-decreasing.
+    void record(Handle h, double weight, double now)
+    {
+        if (!started)
+        {
+            base = now;
+            started = true;
+        }
+        if ((now - base) / halfLife > RESCALE_AFTER_HALF_LIVES)
+        {
+            rescale(now);
+        }
+        if (h >= scores.size())
+        {
+            scores.resize(h + 1, 0.0);
+            tracked.resize(h + 1, false);
+            inTop.resize(h + 1, false);
+        }
+        if (!tracked[h])
+        {
+            tracked[h] = true;
+            trackedCount++;
+        }
+
+        double old = scores[h];
+        double updated = old + weight * std::exp2((now - base) / halfLife);
+        scores[h] = updated;
+        if (inTop[h])
+        {
+            top.erase({old, h});
+            inTop[h] = false;
+        }
+        if (updated >= outsideMax)
+        {
+            top.emplace(updated, h);
+            inTop[h] = true;
+        }
+        if (top.size() > capacity + slack)
+        {
+            auto last = std::prev(top.end());
+            outsideMax = last->first;
+            inTop[last->second] = false;
+            top.erase(last);
+        }
+        if (top.size() < std::min(capacity, trackedCount))
+        {
+            rebuild();
+        }
+    }
+
+    void save(BinaryWriter &out) const
+    {
+        out.put<double>(base);
+        out.put<std::uint8_t>(started);
+        out.put<std::uint64_t>(scores.size());
+        for (Handle h = 0; h < scores.size(); ++h)
+        {
+            out.put<double>(tracked[h] ? scores[h] : NEG_INF);
+        }
+    }
+
+    // Fails if the feed tracks more than itemLimit items.
+    bool load(BinaryReader &in, std::size_t itemLimit)
+    {
+        base = in.get<double>();
+        started = in.get<std::uint8_t>() != 0;
+        std::uint64_t n = in.get<std::uint64_t>();
+        if (in.failed() || n > itemLimit)
+        {
+            return false;
+        }
+        scores.assign(n, 0.0);
+        tracked.assign(n, false);
+        inTop.assign(n, false);
+        trackedCount = 0;
+        for (Handle h = 0; h < n; ++h)
+        {
+            double s = in.get<double>();
+            if (s != NEG_INF)
+            {
+                scores[h] = s;
+                tracked[h] = true;
+                trackedCount++;
+            }
+        }
+        rebuild();
+        return !in.failed();
+    }
+
+    // The k hottest items, hottest first; k is capped at the capacity.
+    std::vector<Handle> hottest(std::size_t k) const
+    {
+        std::vector<Handle> result;
+        k = std::min(k, capacity);
+        for (auto it = top.begin(); it != top.end() && result.size() < k; ++it)
+        {
+            result.push_back(it->second);
+        }
+        return result;
+    }
+};
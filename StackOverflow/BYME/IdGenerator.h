@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Snowflake-style 64-bit ids: 41 bits of milliseconds since EPOCH_MS,
+// 10 bits of worker id and a 12-bit per-millisecond sequence. Each thread
+// leases a worker id on its first call and then generates ids from
+// thread-local state, so no lock or shared counter is touched on the hot
+// path. A lease is returned, with its clock state, when the thread exits,
+// so live threads never share a worker id however many come and go; a
+// thread that would be the 1025th live one gets an exception instead.
+class IdGenerator
+{
+private:
+    static constexpr std::uint64_t EPOCH_MS = 1704067200000ULL; // 2024-01-01
+    static constexpr int WORKER_BITS = 10;
+    static constexpr int SEQUENCE_BITS = 12;
+    static constexpr std::uint64_t MAX_WORKER = (1ULL << WORKER_BITS) - 1;
+    static constexpr std::uint64_t MAX_SEQUENCE = (1ULL << SEQUENCE_BITS) - 1;
+
+    struct WorkerState
+    {
+        std::uint64_t workerId;
+        std::uint64_t lastMs = 0;
+        std::uint64_t sequence = 0;
+    };
+
+    static std::uint64_t nowMs()
+    {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count() - EPOCH_MS;
+    }
+
+    struct WorkerPool
+    {
+        std::mutex mtx;
+        std::uint64_t nextWorker = 0;
+        std::vector<WorkerState> released;
+    };
+
+    static WorkerPool &pool()
+    {
+        static WorkerPool p;
+        return p;
+    }
+
+    // A returned id keeps lastMs and sequence, so its next holder carries on
+    // after the last id the previous one issued.
+    struct Lease
+    {
+        WorkerState state;
+
+        Lease() : state(acquire()) {}
+
+        ~Lease()
+        {
+            WorkerPool &p = pool();
+            std::lock_guard<std::mutex> lock(p.mtx);
+            p.released.push_back(state);
+        }
+
+        static WorkerState acquire()
+        {
+            WorkerPool &p = pool();
+            std::lock_guard<std::mutex> lock(p.mtx);
+            if (!p.released.empty())
+            {
+                WorkerState s = p.released.back();
+                p.released.pop_back();
+                return s;
+            }
+            if (p.nextWorker > MAX_WORKER)
+            {
+                throw std::runtime_error("IdGenerator: every worker id is held by a live thread");
+            }
+            return WorkerState{p.nextWorker++};
+        }
+    };
+
+    static WorkerState &state()
+    {
+        thread_local Lease lease;
+        return lease.state;
+    }
+
+public:
+    static std::uint64_t next()
+    {
+        WorkerState &s = state();
+        // Never step backwards if the wall clock does.
+        std::uint64_t ms = std::max(nowMs(), s.lastMs);
+        if (ms == s.lastMs)
+        {
+            s.sequence = (s.sequence + 1) & MAX_SEQUENCE;
+            if (s.sequence == 0)
+            {
+                // Sequence exhausted for this millisecond; borrow the next one.
+                ms = s.lastMs + 1;
+            }
+        }
+        else
+        {
+            s.sequence = 0;
+        }
+        s.lastMs = ms;
+        return (ms << (WORKER_BITS + SEQUENCE_BITS)) | (s.workerId << SEQUENCE_BITS) | s.sequence;
+    }
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+// Distribution of non-negative integer samples (nanoseconds, item counts)
+// in power-of-two buckets: bucket b holds values in (2^(b-1), 2^b], bucket 0
+// holds 0 and 1. Recording is two relaxed atomic adds with no lock, so const
+// readers can record concurrently. Threads are spread over a few padded
+// stripes so that busy readers do not all bounce the same cache line.
+class Histogram
+{
+public:
+    static constexpr std::size_t BUCKETS = 48;
+
+private:
+    static constexpr std::size_t STRIPES = 8;
+
+    struct alignas(64) Stripe
+    {
+        std::atomic<std::uint64_t> counts[BUCKETS] = {};
+        std::atomic<std::uint64_t> sum{0};
+    };
+
+    Stripe stripes[STRIPES];
+
+    static std::size_t stripeOfThisThread()
+    {
+        static std::atomic<std::size_t> nextStripe{0};
+        thread_local std::size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+        return stripe;
+    }
+
+public:
+    static std::size_t bucketOf(std::uint64_t value)
+    {
+        std::size_t b = value <= 1 ? 0 : 64 - static_cast<std::size_t>(__builtin_clzll(value - 1));
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+
+    void record(std::uint64_t value)
+    {
+        Stripe &s = stripes[stripeOfThisThread()];
+        s.counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    std::uint64_t countIn(std::size_t bucket) const
+    {
+        std::uint64_t n = 0;
+        for (const Stripe &s : stripes)
+        {
+            n += s.counts[bucket].load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    std::uint64_t count() const
+    {
+        std::uint64_t n = 0;
+        for (std::size_t b = 0; b < BUCKETS; ++b)
+        {
+            n += countIn(b);
+        }
+        return n;
+    }
+
+    std::uint64_t sum() const
+    {
+        std::uint64_t total = 0;
+        for (const Stripe &s : stripes)
+        {
+            total += s.sum.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+// Records the time from construction to destruction, in nanoseconds.
+class ScopedTimer
+{
+private:
+    Histogram &histogram;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedTimer(Histogram &histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    ~ScopedTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        histogram.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+};
+
+// Builds a snapshot in the Prometheus text exposition format. Each family
+// is announced once with family(), then followed by its samples; labels are
+// passed preformatted, e.g. `operation="find_question"`.
+class MetricsText
+{
+private:
+    std::string out;
+
+    void line(std::string_view name, std::string_view suffix, std::string_view labels, std::string_view extraLabel, double value)
+    {
+        char number[32];
+        std::snprintf(number, sizeof(number), "%.15g", value);
+        out.append(name).append(suffix);
+        if (!labels.empty() || !extraLabel.empty())
+        {
+            out += '{';
+            out.append(labels);
+            if (!labels.empty() && !extraLabel.empty())
+            {
+                out += ',';
+            }
+            out.append(extraLabel);
+            out += '}';
+        }
+        out.append(" ").append(number).append("\n");
+    }
+
+public:
+    void family(std::string_view name, std::string_view type, std::string_view help)
+    {
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+        out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    }
+
+    void sample(std::string_view name, std::string_view labels, double value)
+    {
+        line(name, "", labels, "", value);
+    }
+
+    // Cumulative buckets from 2^firstBucket to 2^lastBucket, with every
+    // bound and the sum multiplied by scale (1e-9 turns nanoseconds into
+    // seconds). Smaller samples fold into the first bucket.
+    void histogram(std::string_view name, std::string_view labels, const Histogram &h, double scale,
+                   std::size_t firstBucket, std::size_t lastBucket)
+    {
+        std::uint64_t cumulative = 0;
+        for (std::size_t b = 0; b <= lastBucket && b < Histogram::BUCKETS; ++b)
+        {
+            cumulative += h.countIn(b);
+            if (b >= firstBucket)
+            {
+                char bound[40];
+                std::snprintf(bound, sizeof(bound), "le=\"%.6g\"", static_cast<double>(1ULL << b) * scale);
+                line(name, "_bucket", labels, bound, static_cast<double>(cumulative));
+            }
+        }
+        std::uint64_t total = h.count();
+        line(name, "_bucket", labels, "le=\"+Inf\"", static_cast<double>(total));
+        line(name, "_sum", labels, "", static_cast<double>(h.sum()) * scale);
+        line(name, "_count", labels, "", static_cast<double>(total));
+    }
+
+    const std::string &text() const
+    {
+        return out;
+    }
+};
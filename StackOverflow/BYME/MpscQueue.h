@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free multi-producer single-consumer FIFO (Vyukov's
+// node-based queue). push() is one atomic exchange plus a store and never
+// waits; only the consumer thread may call pop() and empty().
+//
+// A producer that has swapped itself in but not yet linked its node briefly
+// hides the items queued behind it, so pop() can report empty for a moment
+// while pushes are in flight. Order between producers is the order of their
+// exchanges.
+template <typename T>
+class MpscQueue
+{
+private:
+    struct Node
+    {
+        std::atomic<Node *> next{nullptr};
+        T value;
+    };
+
+    std::atomic<Node *> head; // last pushed node
+    Node *tail;               // consumed dummy; its successor is the front
+
+public:
+    MpscQueue()
+    {
+        Node *dummy = new Node();
+        head.store(dummy, std::memory_order_relaxed);
+        tail = dummy;
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    ~MpscQueue()
+    {
+        while (tail != nullptr)
+        {
+            Node *next = tail->next.load(std::memory_order_relaxed);
+            delete tail;
+            tail = next;
+        }
+    }
+
+    void push(T value)
+    {
+        Node *node = new Node();
+        node->value = std::move(value);
+        Node *prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T &out)
+    {
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+        {
+            return false;
+        }
+        out = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+};
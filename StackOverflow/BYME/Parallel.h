@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Runs fn(t) for every t in [0, threads), each on its own thread; part 0 runs
+// on the calling thread. Returns once all parts are done.
+template <typename Fn>
+void onThreads(unsigned threads, Fn fn)
+{
+    if (threads <= 1)
+    {
+        fn(0u);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t)
+    {
+        workers.emplace_back([&fn, t]
+                             { fn(t); });
+    }
+    fn(0u);
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+}
+
+// Runs fn(begin, end) over [0, count) split into contiguous ranges, one per
+// thread.
+template <typename Fn>
+void parallelRanges(std::size_t count, unsigned threads, Fn fn)
+{
+    onThreads(threads, [&](unsigned t)
+              { fn(count * t / threads, count * (t + 1) / threads); });
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "Arena.h"
+
+struct QueryCacheStats
+{
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;     // dropped to stay within capacity
+    std::uint64_t invalidations = 0; // dropped because new content matched
+    std::size_t entries = 0;
+    std::size_t bytes = 0; // keys and results, as charged against the budget
+};
+
+// LRU cache of substring-query results (ascending handle lists), keyed by the
+// already normalized query. Shards each have their own lock, so concurrent
+// readers rarely contend. Each shard is bounded by entry count and by bytes,
+// since one result for a short key can hold most of the corpus; a result
+// larger than a shard's byte budget is not cached at all.
+//
+// Invalidation is precise: new content only drops the entries whose key
+// occurs in it. Every key is registered under its first trigram, so a change
+// looks up the content's trigrams instead of testing every entry; keys
+// shorter than a trigram are always checked.
+class QueryCache
+{
+private:
+    static constexpr std::size_t SHARDS = 16;
+
+    struct Entry
+    {
+        std::string key;
+        std::vector<Handle> value;
+    };
+
+    struct Shard
+    {
+        std::mutex mtx;
+        std::list<Entry> lru; // most recent first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> byKey;
+        std::unordered_map<std::uint32_t, std::unordered_set<std::string_view>> byGram;
+        std::unordered_set<std::string_view> shortKeys;
+        std::size_t bytes = 0;
+    };
+
+    std::size_t shardCapacity;
+    std::size_t shardBytes;
+    Shard shards[SHARDS];
+    std::atomic<std::uint64_t> epoch{0};
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> misses{0};
+    std::atomic<std::uint64_t> evictions{0};
+    std::atomic<std::uint64_t> invalidations{0};
+
+    static std::uint32_t gram(std::string_view s, std::size_t i)
+    {
+        return static_cast<unsigned char>(s[i]) | static_cast<unsigned char>(s[i + 1]) << 8 |
+               static_cast<std::uint32_t>(static_cast<unsigned char>(s[i + 2])) << 16;
+    }
+
+    // Entry, list node and index slots are charged as a flat overhead.
+    static std::size_t costOf(std::string_view key, const std::vector<Handle> &value)
+    {
+        return 128 + key.size() + value.size() * sizeof(Handle);
+    }
+
+    Shard &shardFor(std::string_view key)
+    {
+        return shards[std::hash<std::string_view>()(key) % SHARDS];
+    }
+
+    // Caller holds the shard lock.
+    void erase(Shard &shard, std::list<Entry>::iterator it)
+    {
+        std::string_view key = it->key;
+        if (key.size() < 3)
+        {
+            shard.shortKeys.erase(key);
+        }
+        else
+        {
+            auto deps = shard.byGram.find(gram(key, 0));
+            deps->second.erase(key);
+            if (deps->second.empty())
+            {
+                shard.byGram.erase(deps);
+            }
+        }
+        shard.byKey.erase(key);
+        shard.bytes -= costOf(key, it->value);
+        shard.lru.erase(it);
+    }
+
+public:
+    explicit QueryCache(std::size_t capacity = 1024, std::size_t capacityBytes = 64 << 20)
+        : shardCapacity(std::max<std::size_t>(1, capacity / SHARDS)),
+          shardBytes(std::max<std::size_t>(1, capacityBytes / SHARDS)) {}
+
+    // Bumped by every change; pass the value read before computing a result
+    // to put(), so a result computed across a change is not cached.
+    std::uint64_t currentEpoch() const
+    {
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    bool get(std::string_view key, std::vector<Handle> &out)
+    {
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.byKey.find(key);
+        if (it == shard.byKey.end())
+        {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        out = it->second->value;
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void put(std::string_view key, std::vector<Handle> value, std::uint64_t epochBefore)
+    {
+        Shard &shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        std::size_t cost = costOf(key, value);
+        if (epochBefore != currentEpoch() || cost > shardBytes || shard.byKey.count(key))
+        {
+            return;
+        }
+        shard.lru.push_front(Entry{std::string(key), std::move(value)});
+        shard.bytes += cost;
+        std::string_view stored = shard.lru.front().key;
+        shard.byKey.emplace(stored, shard.lru.begin());
+        if (stored.size() < 3)
+        {
+            shard.shortKeys.insert(stored);
+        }
+        else
+        {
+            shard.byGram[gram(stored, 0)].insert(stored);
+        }
+        // The new entry fits on its own, so this stops before reaching it.
+        while (shard.lru.size() > shardCapacity || shard.bytes > shardBytes)
+        {
+            erase(shard, std::prev(shard.lru.end()));
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Handle doc gained the lowercased text `content` (new question text, an
+    // author name, a tag). Drops every entry whose key occurs in it, unless
+    // doc is already part of that entry's result.
+    void invalidateMatching(std::string_view content, Handle doc)
+    {
+        epoch.fetch_add(1, std::memory_order_acq_rel);
+        std::vector<std::uint32_t> grams;
+        for (std::size_t i = 0; i + 3 <= content.size(); ++i)
+        {
+            grams.push_back(gram(content, i));
+        }
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            std::vector<std::string_view> candidates(shard.shortKeys.begin(), shard.shortKeys.end());
+            auto addDeps = [&](const std::unordered_set<std::string_view> &keys)
+            {
+                candidates.insert(candidates.end(), keys.begin(), keys.end());
+            };
+            // Walk whichever side is smaller.
+            if (shard.byGram.size() < grams.size())
+            {
+                for (auto &deps : shard.byGram)
+                {
+                    if (std::binary_search(grams.begin(), grams.end(), deps.first))
+                    {
+                        addDeps(deps.second);
+                    }
+                }
+            }
+            else
+            {
+                for (std::uint32_t g : grams)
+                {
+                    auto deps = shard.byGram.find(g);
+                    if (deps != shard.byGram.end())
+                    {
+                        addDeps(deps->second);
+                    }
+                }
+            }
+            for (std::string_view key : candidates)
+            {
+                if (content.find(key) == std::string_view::npos)
+                {
+                    continue;
+                }
+                auto it = shard.byKey.find(key)->second;
+                if (std::binary_search(it->value.begin(), it->value.end(), doc))
+                {
+                    continue;
+                }
+                erase(shard, it);
+                invalidations.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void clear()
+    {
+        epoch.fetch_add(1, std::memory_order_acq_rel);
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            shard.lru.clear();
+            shard.byKey.clear();
+            shard.byGram.clear();
+            shard.shortKeys.clear();
+            shard.bytes = 0;
+        }
+    }
+
+    QueryCacheStats stats()
+    {
+        QueryCacheStats s;
+        s.hits = hits.load(std::memory_order_relaxed);
+        s.misses = misses.load(std::memory_order_relaxed);
+        s.evictions = evictions.load(std::memory_order_relaxed);
+        s.invalidations = invalidations.load(std::memory_order_relaxed);
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            s.entries += shard.lru.size();
+            s.bytes += shard.bytes;
+        }
+        return s;
+    }
+};
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "Arena.h"
+#include "Parallel.h"
+#include "Storage.h"
+
+// Why a user gained or lost reputation. The post handle of an entry points
+// into the questions or the answers arena depending on the reason.
+enum class ReputationReason : std::uint8_t
+{
+    Question,
+    Answer,
+    QuestionUpvote,
+    QuestionDownvote,
+    AnswerUpvote,
+    AnswerDownvote,
+    Count
+};
+
+// Points per unit of each reason.
+struct ReputationWeights
+{
+    int points[static_cast<std::size_t>(ReputationReason::Count)] = {};
+
+    int of(ReputationReason reason) const
+    {
+        return points[static_cast<std::size_t>(reason)];
+    }
+};
+
+// One ledger line: `units` occurrences of `reason` on `post`, credited to
+// `user`. Units are negative when a vote is withdrawn.
+struct ReputationEntry
+{
+    Handle user;
+    Handle post;
+    std::int16_t units;
+    ReputationReason reason;
+    std::uint8_t spare; // always 0; keeps the entry free of padding for raw saves
+};
+
+// Append-only record of every reputation change. Entries hold units, not
+// points, so the totals can be derived again under different weights, and
+// the stored reputation of any user can be audited against the ledger.
+class ReputationLedger
+{
+private:
+    static constexpr std::size_t ENTRIES_PER_THREAD = 1 << 16;
+
+    ReputationWeights weights;
+    std::vector<ReputationEntry> entries;
+
+    static int pointsOf(const ReputationEntry &e, const ReputationWeights &w)
+    {
+        return e.units * w.of(e.reason);
+    }
+
+public:
+    explicit ReputationLedger(const ReputationWeights &weights) : weights(weights) {}
+
+    const ReputationWeights &getWeights() const
+    {
+        return weights;
+    }
+
+    std::size_t size() const
+    {
+        return entries.size();
+    }
+
+    std::size_t memoryBytes() const
+    {
+        return entries.capacity() * sizeof(ReputationEntry);
+    }
+
+    // Appends units of reason and returns the points they are worth now.
+    // Counts beyond an entry's range are split across several entries.
+    int record(Handle user, Handle post, ReputationReason reason, int units)
+    {
+        int points = units * weights.of(reason);
+        while (units != 0)
+        {
+            int part = std::max<int>(INT16_MIN, std::min<int>(INT16_MAX, units));
+            entries.push_back({user, post, static_cast<std::int16_t>(part), reason, 0});
+            units -= part;
+        }
+        return points;
+    }
+
+    // Every entry of one user, oldest first. Walks the whole ledger.
+    std::vector<ReputationEntry> historyOf(Handle user) const
+    {
+        std::vector<ReputationEntry> result;
+        for (const ReputationEntry &e : entries)
+        {
+            if (e.user == user)
+            {
+                result.push_back(e);
+            }
+        }
+        return result;
+    }
+
+    // Per-user sums of the entries from `from` on, for users below
+    // userCount. With several threads, each takes a slice of the ledger and
+    // scatters its (user, points) pairs into per-shard runs, shards being
+    // contiguous user ranges; each shard is then summed by one thread, so
+    // no counter is written by two threads.
+    std::vector<int> totals(const ReputationWeights &w, std::size_t userCount, unsigned threads, std::size_t from = 0) const
+    {
+        std::vector<int> sums(userCount, 0);
+        from = std::min(from, entries.size());
+        std::size_t n = entries.size() - from;
+        threads = static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(threads, n / ENTRIES_PER_THREAD)));
+        if (threads == 1 || userCount == 0)
+        {
+            for (std::size_t i = from; i < entries.size(); ++i)
+            {
+                if (entries[i].user < userCount)
+                {
+                    sums[entries[i].user] += pointsOf(entries[i], w);
+                }
+            }
+            return sums;
+        }
+
+        std::size_t span = (userCount + threads - 1) / threads;
+        auto slice = [&](unsigned t)
+        {
+            return std::make_pair(from + n * t / threads, from + n * (t + 1) / threads);
+        };
+        // offsets[t * threads + s]: where slice t writes into shard s.
+        std::vector<std::size_t> offsets(static_cast<std::size_t>(threads) * threads, 0);
+        onThreads(threads, [&](unsigned t)
+                  {
+                      auto [begin, end] = slice(t);
+                      for (std::size_t i = begin; i < end; ++i)
+                      {
+                          if (entries[i].user < userCount)
+                          {
+                              offsets[t * threads + entries[i].user / span]++;
+                          }
+                      } });
+        std::vector<std::size_t> shardBegin(threads + 1, 0);
+        std::size_t pos = 0;
+        for (unsigned s = 0; s < threads; ++s)
+        {
+            shardBegin[s] = pos;
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                std::size_t count = offsets[t * threads + s];
+                offsets[t * threads + s] = pos;
+                pos += count;
+            }
+        }
+        shardBegin[threads] = pos;
+
+        std::vector<std::pair<Handle, int>> scattered(pos);
+        onThreads(threads, [&](unsigned t)
+                  {
+                      auto [begin, end] = slice(t);
+                      std::size_t *next = offsets.data() + static_cast<std::size_t>(t) * threads;
+                      for (std::size_t i = begin; i < end; ++i)
+                      {
+                          if (entries[i].user < userCount)
+                          {
+                              scattered[next[entries[i].user / span]++] = {entries[i].user, pointsOf(entries[i], w)};
+                          }
+                      } });
+        onThreads(threads, [&](unsigned s)
+                  {
+                      for (std::size_t i = shardBegin[s]; i < shardBegin[s + 1]; ++i)
+                      {
+                          sums[scattered[i].first] += scattered[i].second;
+                      } });
+        return sums;
+    }
+
+    std::vector<int> totals(std::size_t userCount, unsigned threads, std::size_t from = 0) const
+    {
+        return totals(weights, userCount, threads, from);
+    }
+
+    void save(BinaryWriter &out) const
+    {
+        out.put<std::uint64_t>(entries.size());
+        out.putBytes(entries.data(), entries.size() * sizeof(ReputationEntry));
+    }
+
+    // Rejects entries for users at or past userCount or with an unknown
+    // reason.
+    bool load(BinaryReader &in, std::size_t userCount)
+    {
+        std::uint64_t n = in.get<std::uint64_t>();
+        const void *first = in.getBytes(n * sizeof(ReputationEntry));
+        if (in.failed())
+        {
+            return false;
+        }
+        entries.resize(n);
+        std::memcpy(entries.data(), first, n * sizeof(ReputationEntry));
+        return std::all_of(entries.begin(), entries.end(), [&](const ReputationEntry &e)
+                           { return e.user < userCount && e.reason < ReputationReason::Count; });
+    }
+};
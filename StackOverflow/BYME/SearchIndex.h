@@ -0,0 +1,453 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Arena.h"
+#include "Parallel.h"
+#include "Storage.h"
+
+// Splits text into lowercase search terms. Letters, digits and the
+// characters that show up in tag names ("c++", "c#", "std-vector") are
+// kept; everything else separates terms. The callback receives a view
+// into a scratch buffer that is reused for the next term.
+template <typename Fn>
+void forEachTerm(std::string_view text, Fn &&fn)
+{
+    std::string term;
+    for (std::size_t i = 0; i <= text.size(); ++i)
+    {
+        unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+        if (std::isalnum(c) || c == '+' || c == '#' || c == '_' || c == '-')
+        {
+            term.push_back(static_cast<char>(std::tolower(c)));
+        }
+        else if (!term.empty())
+        {
+            fn(std::string_view(term));
+            term.clear();
+        }
+    }
+}
+
+struct ScoredDoc
+{
+    Handle doc;
+    double score;
+};
+
+// Inverted index with BM25 ranking over document text, a fixed bonus per
+// query term that is also one of the document's tags, and a per-document
+// static boost supplied by the owner. Documents are identified by their
+// arena handle and postings are kept sorted by it.
+//
+// search() runs document-at-a-time MaxScore: lists whose combined upper
+// bound cannot lift a document into the current top-k are only probed for
+// candidates that the remaining lists produced, so most of a long posting
+// list is skipped once the heap has filled up.
+class SearchIndex
+{
+public:
+    static constexpr double K1 = 1.2;
+    static constexpr double B = 0.75;
+    static constexpr double TAG_MATCH_BOOST = 2.0;
+
+private:
+    struct Posting
+    {
+        Handle doc;
+        std::uint32_t tf;
+    };
+
+    struct PostingList
+    {
+        std::vector<Posting> postings;
+        std::uint32_t maxTf = 0;
+    };
+
+    struct Cursor
+    {
+        const Posting *cur;
+        const Posting *end;
+        double idf;
+        bool isTag;
+        double upperBound;
+    };
+
+    std::unordered_map<std::string, PostingList> textPostings;
+    std::unordered_map<std::string, PostingList> tagPostings;
+    std::vector<std::uint32_t> docLength;
+    std::vector<float> docBoost;
+    std::uint64_t totalLength = 0;
+    std::uint32_t docCount = 0;
+    // Only ever raised, so it stays a valid bound when boosts go down.
+    double maxBoost = 0;
+
+    double idf(std::size_t df) const
+    {
+        return std::log(1.0 + (docCount - df + 0.5) / (df + 0.5));
+    }
+
+    double termScore(const Cursor &c, const Posting &p, double avgLength) const
+    {
+        if (c.isTag)
+        {
+            return TAG_MATCH_BOOST;
+        }
+        double norm = 1.0 - B + B * docLength[p.doc] / avgLength;
+        return c.idf * p.tf * (K1 + 1) / (p.tf + K1 * norm);
+    }
+
+    void ensureDoc(Handle doc)
+    {
+        if (doc >= docLength.size())
+        {
+            docLength.resize(doc + 1, 0);
+            docBoost.resize(doc + 1, 0.0f);
+        }
+    }
+
+public:
+    // Documents must be added in increasing handle order.
+    void addDocument(Handle doc, std::string_view text)
+    {
+        ensureDoc(doc);
+        std::unordered_map<std::string, std::uint32_t> counts;
+        std::uint32_t length = 0;
+        forEachTerm(text, [&](std::string_view term)
+                    {
+                        counts[std::string(term)]++;
+                        length++;
+                    });
+        for (auto &[term, tf] : counts)
+        {
+            PostingList &list = textPostings[term];
+            list.postings.push_back({doc, tf});
+            list.maxTf = std::max(list.maxTf, tf);
+        }
+        docLength[doc] = length;
+        totalLength += length;
+        docCount++;
+    }
+
+    // Bulk version of addDocument for texts[i] = document first + i, all
+    // newer than anything indexed so far. Each thread tokenises a contiguous
+    // range of documents into private posting lists; the lists are then
+    // appended range by range, which keeps every list sorted by handle.
+    void addDocuments(Handle first, const std::vector<std::string_view> &texts, unsigned threads)
+    {
+        if (texts.empty())
+        {
+            return;
+        }
+        ensureDoc(first + static_cast<Handle>(texts.size()) - 1);
+        threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(texts.size())));
+        std::vector<std::unordered_map<std::string, PostingList>> partial(threads);
+        std::vector<std::uint64_t> partialLength(threads, 0);
+        onThreads(threads, [&](unsigned t)
+                  {
+                      std::size_t begin = texts.size() * t / threads;
+                      std::size_t end = texts.size() * (t + 1) / threads;
+                      std::unordered_map<std::string, std::uint32_t> counts;
+                      for (std::size_t i = begin; i < end; ++i)
+                      {
+                          counts.clear();
+                          std::uint32_t length = 0;
+                          forEachTerm(texts[i], [&](std::string_view term)
+                                      {
+                                          counts[std::string(term)]++;
+                                          length++;
+                                      });
+                          Handle doc = first + static_cast<Handle>(i);
+                          for (auto &[term, tf] : counts)
+                          {
+                              PostingList &list = partial[t][term];
+                              list.postings.push_back({doc, tf});
+                              list.maxTf = std::max(list.maxTf, tf);
+                          }
+                          docLength[doc] = length;
+                          partialLength[t] += length;
+                      } });
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            for (auto &[term, list] : partial[t])
+            {
+                PostingList &merged = textPostings[term];
+                if (merged.postings.empty())
+                {
+                    merged.postings = std::move(list.postings);
+                }
+                else
+                {
+                    merged.postings.insert(merged.postings.end(), list.postings.begin(), list.postings.end());
+                }
+                merged.maxTf = std::max(merged.maxTf, list.maxTf);
+            }
+            totalLength += partialLength[t];
+        }
+        docCount += static_cast<std::uint32_t>(texts.size());
+    }
+
+    void addTag(Handle doc, std::string_view tagName)
+    {
+        std::string key;
+        forEachTerm(tagName, [&](std::string_view term)
+                    { key += term; });
+        PostingList &list = tagPostings[key];
+        std::vector<Posting> &postings = list.postings;
+        list.maxTf = 1;
+        // Tags are usually attached right after the question is posted, so
+        // the insertion point is almost always the end.
+        auto it = std::lower_bound(postings.begin(), postings.end(), doc,
+                                   [](const Posting &p, Handle d)
+                                   { return p.doc < d; });
+        if (it == postings.end() || it->doc != doc)
+        {
+            postings.insert(it, {doc, 1});
+        }
+    }
+
+    void setBoost(Handle doc, double boost)
+    {
+        ensureDoc(doc);
+        docBoost[doc] = static_cast<float>(boost);
+        maxBoost = std::max(maxBoost, boost);
+    }
+
+    void save(BinaryWriter &out) const
+    {
+        out.put<std::uint32_t>(docCount);
+        out.put<std::uint64_t>(totalLength);
+        out.put<double>(maxBoost);
+        out.put<std::uint64_t>(docLength.size());
+        out.putBytes(docLength.data(), docLength.size() * sizeof(std::uint32_t));
+        out.putBytes(docBoost.data(), docBoost.size() * sizeof(float));
+        for (const auto *postings : {&textPostings, &tagPostings})
+        {
+            out.put<std::uint64_t>(postings->size());
+            for (auto &[term, list] : *postings)
+            {
+                out.putString(term);
+                out.put<std::uint32_t>(list.maxTf);
+                out.put<std::uint64_t>(list.postings.size());
+                out.putBytes(list.postings.data(), list.postings.size() * sizeof(Posting));
+            }
+        }
+    }
+
+    // Replaces the index with one written by save(); posting lists are
+    // copied straight out of the (mapped) snapshot bytes. Fails if the index
+    // covers more than docLimit documents.
+    bool load(BinaryReader &in, std::size_t docLimit)
+    {
+        docCount = in.get<std::uint32_t>();
+        totalLength = in.get<std::uint64_t>();
+        maxBoost = in.get<double>();
+        std::uint64_t docs = in.get<std::uint64_t>();
+        const void *lengths = in.getBytes(docs * sizeof(std::uint32_t));
+        const void *boosts = in.getBytes(docs * sizeof(float));
+        if (in.failed() || docs > docLimit)
+        {
+            return false;
+        }
+        docLength.resize(docs);
+        docBoost.resize(docs);
+        std::memcpy(docLength.data(), lengths, docs * sizeof(std::uint32_t));
+        std::memcpy(docBoost.data(), boosts, docs * sizeof(float));
+        for (auto *postings : {&textPostings, &tagPostings})
+        {
+            postings->clear();
+            std::uint64_t terms = in.get<std::uint64_t>();
+            postings->reserve(terms);
+            for (std::uint64_t i = 0; i < terms && !in.failed(); ++i)
+            {
+                PostingList &list = (*postings)[std::string(in.getString())];
+                list.maxTf = in.get<std::uint32_t>();
+                std::uint64_t n = in.get<std::uint64_t>();
+                const Posting *first = static_cast<const Posting *>(in.getBytes(n * sizeof(Posting)));
+                if (!in.failed())
+                {
+                    list.postings.assign(first, first + n);
+                }
+                for (const Posting &p : list.postings)
+                {
+                    if (p.doc >= docs)
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+        return !in.failed();
+    }
+
+    // Approximate heap footprint: posting arrays, term keys and hash nodes.
+    std::size_t memoryBytes() const
+    {
+        std::size_t total = (docLength.capacity() + docBoost.capacity()) * sizeof(std::uint32_t);
+        for (const auto *postings : {&textPostings, &tagPostings})
+        {
+            total += postings->bucket_count() * sizeof(void *);
+            for (auto &[term, list] : *postings)
+            {
+                total += sizeof(std::pair<const std::string, PostingList>) + sizeof(void *) +
+                         ownedBytes(term) + ownedBytes(list.postings);
+            }
+        }
+        return total;
+    }
+
+    // If candidates is given, it receives the number of documents scored,
+    // which shows how much the bounds pruned.
+    std::vector<ScoredDoc> search(std::string_view query, std::size_t k, std::size_t *candidates = nullptr) const
+    {
+        std::vector<ScoredDoc> results;
+        if (k == 0 || docCount == 0)
+        {
+            return results;
+        }
+        double avgLength = std::max(1.0, static_cast<double>(totalLength) / docCount);
+
+        std::vector<Cursor> lists;
+        std::unordered_set<std::string> seen;
+        forEachTerm(query, [&](std::string_view term)
+                    {
+                        std::string key(term);
+                        if (!seen.insert(key).second)
+                        {
+                            return;
+                        }
+                        auto text = textPostings.find(key);
+                        if (text != textPostings.end())
+                        {
+                            const PostingList &pl = text->second;
+                            double w = idf(pl.postings.size());
+                            // tf / (tf + K1 * norm) peaks at the highest tf and the
+                            // shortest possible document (norm >= 1 - B).
+                            double bound = w * pl.maxTf * (K1 + 1) / (pl.maxTf + K1 * (1 - B));
+                            lists.push_back({pl.postings.data(), pl.postings.data() + pl.postings.size(), w, false, bound});
+                        }
+                        auto tag = tagPostings.find(key);
+                        if (tag != tagPostings.end() && !tag->second.postings.empty())
+                        {
+                            const PostingList &pl = tag->second;
+                            lists.push_back({pl.postings.data(), pl.postings.data() + pl.postings.size(), 0.0, true, TAG_MATCH_BOOST});
+                        }
+                    });
+        if (lists.empty())
+        {
+            return results;
+        }
+
+        std::sort(lists.begin(), lists.end(), [](const Cursor &a, const Cursor &b)
+                  { return a.upperBound < b.upperBound; });
+        std::vector<double> prefixBound(lists.size());
+        double running = 0;
+        for (std::size_t i = 0; i < lists.size(); ++i)
+        {
+            running += lists[i].upperBound;
+            prefixBound[i] = running;
+        }
+
+        auto worse = [](const ScoredDoc &a, const ScoredDoc &b)
+        { return a.score > b.score || (a.score == b.score && a.doc < b.doc); };
+        std::priority_queue<ScoredDoc, std::vector<ScoredDoc>, decltype(worse)> heap(worse);
+        double threshold = -std::numeric_limits<double>::infinity();
+        std::size_t firstEssential = 0;
+
+        while (true)
+        {
+            // Lists below firstEssential cannot reach the threshold on their
+            // own, so they never propose candidates.
+            while (firstEssential < lists.size() && prefixBound[firstEssential] + maxBoost <= threshold)
+            {
+                firstEssential++;
+            }
+            if (firstEssential == lists.size())
+            {
+                break;
+            }
+
+            Handle doc = INVALID_HANDLE;
+            for (std::size_t i = firstEssential; i < lists.size(); ++i)
+            {
+                if (lists[i].cur != lists[i].end)
+                {
+                    doc = std::min(doc, lists[i].cur->doc);
+                }
+            }
+            if (doc == INVALID_HANDLE)
+            {
+                break;
+            }
+            if (candidates != nullptr)
+            {
+                ++*candidates;
+            }
+
+            double score = 0;
+            for (std::size_t i = firstEssential; i < lists.size(); ++i)
+            {
+                Cursor &c = lists[i];
+                if (c.cur != c.end && c.cur->doc == doc)
+                {
+                    score += termScore(c, *c.cur, avgLength);
+                    c.cur++;
+                }
+            }
+
+            bool pruned = false;
+            for (std::size_t i = firstEssential; i-- > 0;)
+            {
+                if (score + prefixBound[i] + maxBoost <= threshold)
+                {
+                    pruned = true;
+                    break;
+                }
+                Cursor &c = lists[i];
+                c.cur = std::lower_bound(c.cur, c.end, doc, [](const Posting &p, Handle d)
+                                         { return p.doc < d; });
+                if (c.cur != c.end && c.cur->doc == doc)
+                {
+                    score += termScore(c, *c.cur, avgLength);
+                }
+            }
+            if (pruned)
+            {
+                continue;
+            }
+
+            score += docBoost[doc];
+            if (heap.size() < k)
+            {
+                heap.push({doc, score});
+            }
+            else if (score > heap.top().score)
+            {
+                heap.pop();
+                heap.push({doc, score});
+            }
+            if (heap.size() == k)
+            {
+                threshold = heap.top().score;
+            }
+        }
+
+        results.reserve(heap.size());
+        while (!heap.empty())
+        {
+            results.push_back(heap.top());
+            heap.pop();
+        }
+        std::reverse(results.begin(), results.end());
+        return results;
+    }
+};
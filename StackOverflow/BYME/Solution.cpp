@@ -7,8 +7,22 @@
 // The system should assign reputation score to users based on their activity and the quality of their contributions.
 
 #include <bits/stdc++.h>
-#include <random>
 #include <unordered_set>
+#include "Arena.h"
+#include "IdGenerator.h"
+#include "SearchIndex.h"
+#include "Autocomplete.h"
+#include "HotFeed.h"
+#include "Storage.h"
+#include "TextStore.h"
+#include "DumpReader.h"
+#include "QueryCache.h"
+#include "TextSearch.h"
+#include "MpscQueue.h"
+#include "DuplicateIndex.h"
+#include "ReputationLedger.h"
+#include "Metrics.h"
+#include "Parallel.h"
 using namespace std;
 
 const int REPUTATION_FOR_QUESTION = 5;
@@ -18,32 +32,110 @@ const int REPUTATION_FOR_ANSWER_UPVOTE = 15;
 const int REPUTATION_FOR_DOWNVOTE = 2;
 // const int REPUTATION_FOR_VOTER_DOWNVOTE = 1;
 
+// The constants above as reputation ledger weights; a downvote costs the
+// post's author.
+ReputationWeights reputationWeights()
+{
+    ReputationWeights weights;
+    weights.points[static_cast<size_t>(ReputationReason::Question)] = REPUTATION_FOR_QUESTION;
+    weights.points[static_cast<size_t>(ReputationReason::Answer)] = REPUTATION_FOR_ANSWER;
+    weights.points[static_cast<size_t>(ReputationReason::QuestionUpvote)] = REPUTATION_FOR_QUESTION_UPVOTE;
+    weights.points[static_cast<size_t>(ReputationReason::QuestionDownvote)] = -REPUTATION_FOR_DOWNVOTE;
+    weights.points[static_cast<size_t>(ReputationReason::AnswerUpvote)] = REPUTATION_FOR_ANSWER_UPVOTE;
+    weights.points[static_cast<size_t>(ReputationReason::AnswerDownvote)] = -REPUTATION_FOR_DOWNVOTE;
+    return weights;
+}
+
+// Ranked search adds these on top of the BM25 text score.
+const double SEARCH_VOTE_WEIGHT = 0.5;
+const double SEARCH_ANSWER_WEIGHT = 0.3;
+
+// Activity weights for the hot questions feed; a vote counts per point of
+// score change, so flipping a vote counts twice.
+const double HOT_WEIGHT_QUESTION = 1.0;
+const double HOT_WEIGHT_ANSWER = 2.0;
+const double HOT_WEIGHT_COMMENT = 0.5;
+const double HOT_WEIGHT_VOTE = 1.0;
+
+// findQuestion only fans out across threads once each would get at least
+// this much question text to scan.
+const size_t FIND_BYTES_PER_THREAD = 4 << 20;
+
+// Derived indexes are rebuilt from question texts in windows of about this
+// many bytes, so cold bodies are only decompressed a window at a time.
+const size_t TEXT_WINDOW_BYTES = 64 << 20;
+
+// Estimated shingle overlap from which a question counts as a likely duplicate.
+const double DUPLICATE_MIN_SIMILARITY = 0.5;
+
 enum class voteType
 {
     Upvote,
     Downvote
 };
 
-string generateRandomString(int length = 10)
+// Every entity lives in an Arena owned by StackOverflow; these aliases only
+// document which arena a handle points into.
+using UserHandle = Handle;
+using TagHandle = Handle;
+using VoteHandle = Handle;
+using CommentHandle = Handle;
+using AnswerHandle = Handle;
+using QuestionHandle = Handle;
+
+// Public identifier of a post, handed out by IdGenerator.
+using PostId = uint64_t;
+
+enum class PostKind : uint8_t
 {
-    static const char charset[] =
-        "abcdefghijklmnopqrstuvwxyz"
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "0123456789";
-    static random_device rd;
-    static mt19937 gen(rd());
-    static uniform_int_distribution<> dis(0, sizeof(charset) - 2);
-
-    string result;
-    result.reserve(length);
-    for (int i = 0; i < length; ++i)
-        result += charset[dis(gen)];
-    return result;
-}
+    Question,
+    Answer,
+    Comment
+};
+
+// Where a PostId lives: which arena, and the handle inside it.
+struct PostRef
+{
+    PostKind kind;
+    Handle handle = INVALID_HANDLE;
+};
 
-string toLower(const string &str)
+// What a vote call did: cast a new vote, withdraw the voter's vote by
+// repeating it, or flip it to the other type.
+enum class VoteAction : uint8_t
 {
-    string result = str;
+    Cast,
+    Withdraw,
+    Flip
+};
+
+// How one vote call moved a post's upvote and downvote counts.
+struct VoteChange
+{
+    int up = 0;
+    int down = 0;
+    size_t examined = 0; // existing votes compared while looking for the voter's
+
+    VoteAction action() const
+    {
+        int net = up + down;
+        return net > 0 ? VoteAction::Cast : net < 0 ? VoteAction::Withdraw : VoteAction::Flip;
+    }
+};
+
+// One vote call by a user, kept in their activity history. Votes themselves
+// are released when withdrawn, so the history stores the post id instead.
+// type is the vote cast, withdrawn, or flipped to.
+struct VoteRecord
+{
+    PostId post;
+    voteType type;
+    VoteAction action;
+};
+
+string toLower(string_view str)
+{
+    string result(str);
     transform(result.begin(), result.end(), result.begin(), ::tolower);
     return result;
 }
@@ -54,13 +146,63 @@ private:
     string username;
     string Name;
     int reputation = 0;
+    // Activity in creation order, only ever appended to.
+    vector<QuestionHandle> questions;
+    vector<AnswerHandle> answers;
+    vector<CommentHandle> comments;
+    vector<VoteRecord> votesCast;
 
 public:
     User(string uname, string name) : username(uname), Name(name) {};
-    string getUsername() const { return username; }
-    string getName() const { return Name; }
+    const string &getUsername() const { return username; }
+    const string &getName() const { return Name; }
+
+    void addQuestion(QuestionHandle Q) { questions.push_back(Q); }
+    void addAnswer(AnswerHandle A) { answers.push_back(A); }
+    void addComment(CommentHandle C) { comments.push_back(C); }
+    void addVoteCast(VoteRecord vote) { votesCast.push_back(vote); }
+
+    const vector<QuestionHandle> &getQuestions() const
+    {
+        return questions;
+    }
+
+    Slice<QuestionHandle> getQuestions(size_t offset, size_t limit) const
+    {
+        return pageOf(questions, offset, limit);
+    }
+
+    const vector<AnswerHandle> &getAnswers() const
+    {
+        return answers;
+    }
+
+    Slice<AnswerHandle> getAnswers(size_t offset, size_t limit) const
+    {
+        return pageOf(answers, offset, limit);
+    }
+
+    const vector<CommentHandle> &getComments() const
+    {
+        return comments;
+    }
+
+    Slice<CommentHandle> getComments(size_t offset, size_t limit) const
+    {
+        return pageOf(comments, offset, limit);
+    }
+
+    const vector<VoteRecord> &getVotesCast() const
+    {
+        return votesCast;
+    }
+
+    Slice<VoteRecord> getVotesCast(size_t offset, size_t limit) const
+    {
+        return pageOf(votesCast, offset, limit);
+    }
 
-    int getReputation()
+    int getReputation() const
     {
         return reputation;
     }
@@ -74,38 +216,64 @@ public:
     {
         reputation -= point;
     }
+
+    void setReputation(int point)
+    {
+        reputation = point;
+    }
+
+    size_t heapBytes() const
+    {
+        return ownedBytes(username) + ownedBytes(Name) + ownedBytes(questions) + ownedBytes(answers) +
+               ownedBytes(comments) + ownedBytes(votesCast);
+    }
 };
 
 class Tags
 {
 private:
     string tagName;
+    int usageCount = 0;
 
 public:
-    Tags(string tagName) : tagName(tagName) {};
+    Tags(string tagName, int usageCount = 0) : tagName(tagName), usageCount(usageCount) {};
 
-    string getTag()
+    const string &getTag() const
     {
         return tagName;
     }
+
+    int getUsageCount() const
+    {
+        return usageCount;
+    }
+
+    void addUsage()
+    {
+        usageCount++;
+    }
+
+    size_t heapBytes() const
+    {
+        return ownedBytes(tagName);
+    }
 };
 
 class Vote
 {
 private:
-    shared_ptr<User> user;
+    UserHandle user;
     voteType type;
 
 public:
-    Vote(shared_ptr<User> user, voteType vote) : user(user), type(vote) {};
-    ~Vote() = default;
+    Vote(UserHandle user, voteType vote) : user(user), type(vote) {};
 
-    voteType getVoteType()
+    voteType getVoteType() const
     {
         return type;
     }
 
-    shared_ptr<User> getuser()
+    UserHandle getuser() const
     {
         return user;
     }
@@ -126,346 +294,2178 @@ public:
 class Comments
 {
 protected:
-    string commentId;
-    string commentText;
-    shared_ptr<User> user;
+    PostId commentId;
+    TextRef commentText;
+    UserHandle user;
     // commentType type;
 
 public:
-    Comments(string cId, string comment, shared_ptr<User> userPtr)
-        : commentId(cId), commentText(comment), user(userPtr) {}
+    Comments(PostId cId, TextRef comment, UserHandle userHandle)
+        : commentId(cId), commentText(comment), user(userHandle) {}
+
+    PostId getCommentId() const
+    {
+        return commentId;
+    }
+
+    TextRef getCommentText() const
+    {
+        return commentText;
+    }
+
+    UserHandle getUser() const
+    {
+        return user;
+    }
 };
 
 class Answer
 {
 private:
-    string answerId;
-    string answerText;
-    shared_ptr<User> user;
-    vector<shared_ptr<Vote>> votes;
-    vector<shared_ptr<Comments>> comments;
+    PostId answerId;
+    TextRef answerText;
+    UserHandle user;
+    QuestionHandle question;
+    vector<VoteHandle> votes;
+    vector<CommentHandle> comments;
     int upVote = 0;
     int downVote = 0;
+    // Position of this answer in its question's score-ordered list.
+    uint32_t rankPos = 0;
 
 public:
-    Answer(string answerId, string answerText, shared_ptr<User> user) : answerId(answerId), answerText(answerText), user(user) {};
+    Answer(PostId answerId, TextRef answerText, UserHandle user, QuestionHandle question)
+        : answerId(answerId), answerText(answerText), user(user), question(question) {};
+
+    PostId getAnswerId() const
+    {
+        return answerId;
+    }
 
-    string getAnswerText()
+    TextRef getAnswerText() const
     {
         return answerText;
     }
 
-    shared_ptr<User> getUser()
+    UserHandle getUser() const
     {
         return user;
     }
 
-    void addVote(shared_ptr<User> U, voteType V)
+    QuestionHandle getQuestion() const
     {
+        return question;
+    }
+
+    // Toggles U's vote and returns how the counts moved; the caller turns
+    // that into reputation.
+    VoteChange addVote(UserHandle U, voteType V, Arena<Vote> &votePool)
+    {
+        VoteChange change;
         for (auto it = votes.begin(); it != votes.end(); ++it)
         {
-            if ((*it)->getuser() == U)
+            Vote &vote = votePool[*it];
+            change.examined++;
+            if (vote.getuser() == U)
             {
-                if ((*it)->getVoteType() == V)
+                if (vote.getVoteType() == V)
                 {
                     if (V == voteType::Upvote)
                     {
                         upVote--;
-                        user->addReputation(-REPUTATION_FOR_ANSWER_UPVOTE);
+                        change.up--;
                     }
                     else
                     {
                         downVote--;
-                        user->reduceReputation(REPUTATION_FOR_DOWNVOTE);
+                        change.down--;
                     }
+                    votePool.release(*it);
                     votes.erase(it); // Erase the vote object
-                    return;
+                    return change;
                 }
                 else
                 {
-                    (*it)->alterVote();
+                    vote.alterVote();
                     if (V == voteType::Upvote)
                     {
                         upVote++;
-                        user->addReputation(REPUTATION_FOR_ANSWER_UPVOTE);
+                        change.up++;
                         downVote--;
-                        user->reduceReputation(REPUTATION_FOR_DOWNVOTE);
+                        change.down--;
                     }
                     else
                     {
                         upVote--;
-                        user->addReputation(-REPUTATION_FOR_ANSWER_UPVOTE);
+                        change.up--;
                         downVote++;
-                        user->reduceReputation(-REPUTATION_FOR_DOWNVOTE);
+                        change.down++;
                     }
-                    return;
+                    return change;
                 }
             }
         }
         // If user hasn't voted yet, add new vote
-        auto newVote = make_shared<Vote>(U, V);
-        votes.push_back(newVote);
+        votes.push_back(votePool.emplace(U, V));
+        if (V == voteType::Upvote)
+        {
+            upVote++;
+            change.up++;
+        }
+        else
+        {
+            downVote++;
+            change.down++;
+        }
+        return change;
+    }
+
+    // U's current vote on this post, or nullptr.
+    const Vote *findVote(UserHandle U, const Arena<Vote> &votePool) const
+    {
+        for (VoteHandle v : votes)
+        {
+            if (votePool[v].getuser() == U)
+            {
+                return &votePool[v];
+            }
+        }
+        return nullptr;
+    }
+
+    const vector<VoteHandle> &getVotes() const
+    {
+        return votes;
+    }
+
+    // Re-attaches a stored vote without touching reputation (snapshot load).
+    void restoreVote(VoteHandle vote, voteType V)
+    {
+        votes.push_back(vote);
         if (V == voteType::Upvote)
         {
             upVote++;
-            user->addReputation(REPUTATION_FOR_ANSWER_UPVOTE);
         }
         else
         {
             downVote++;
-            user->reduceReputation(REPUTATION_FOR_DOWNVOTE);
         }
     }
 
-    int getUpvote()
+    // Votes known only as totals (imported dumps do not say who voted).
+    // They count towards the score but cannot be toggled by anyone.
+    void addAnonymousVotes(int up, int down)
+    {
+        upVote += up;
+        downVote += down;
+    }
+
+    int getUpvote() const
     {
         return upVote;
     }
 
-    int getDownVote()
+    int getDownVote() const
     {
         return downVote;
     }
 
-    void addComment(shared_ptr<User> U, const string &commentText)
+    int getScore() const
+    {
+        return upVote - downVote;
+    }
+
+    uint32_t getRankPos() const
+    {
+        return rankPos;
+    }
+
+    void setRankPos(uint32_t pos)
+    {
+        rankPos = pos;
+    }
+
+    void addComment(CommentHandle C)
     {
-        string cId = generateRandomString();
-        auto newComment = make_shared<Comments>(cId, commentText, U);
-        comments.push_back(newComment);
+        comments.push_back(C);
     }
 
-    vector<shared_ptr<Comments>> getComments(){
+    const vector<CommentHandle> &getComments() const
+    {
         return comments;
     }
+
+    Slice<CommentHandle> getComments(size_t offset, size_t limit) const
+    {
+        return pageOf(comments, offset, limit);
+    }
+
+    size_t heapBytes() const
+    {
+        return ownedBytes(votes) + ownedBytes(comments);
+    }
 };
 
 class Question
 {
 private:
-    string questionId;
-    string questionText;
-    vector<shared_ptr<Answer>> answers;
-    vector<shared_ptr<Tags>> tags;
-    shared_ptr<User> user;
-    vector<shared_ptr<Vote>> votes;
-    vector<shared_ptr<Comments>> comments;
+    PostId questionId;
+    TextRef questionText;
+    vector<AnswerHandle> answers;
+    // Same answers ordered by score (ties: oldest first), kept sorted as
+    // votes arrive so the top answers never need a sort.
+    vector<AnswerHandle> rankedAnswers;
+    vector<TagHandle> tags;
+    UserHandle user;
+    vector<VoteHandle> votes;
+    vector<CommentHandle> comments;
     int upVote = 0;
     int downVote = 0;
 
 public:
-    Question(string qId, string qText, shared_ptr<User> user) : questionId(qId), questionText(qText), user(user) {};
-    void addTag(shared_ptr<Tags> tag)
+    Question(PostId qId, TextRef qText, UserHandle user) : questionId(qId), questionText(qText), user(user) {};
+
+    PostId getQuestionId() const
     {
+        return questionId;
+    }
+
+    // Returns false if the question already had this tag.
+    bool addTag(TagHandle tag)
+    {
+        if (find(tags.begin(), tags.end(), tag) != tags.end())
+        {
+            return false;
+        }
         tags.push_back(tag);
+        return true;
     }
 
-    string getUsername()
+    UserHandle getUser() const
     {
-        return user->getName();
+        return user;
     }
 
-    string getQuestionText()
+    TextRef getQuestionText() const
     {
         return questionText;
     }
 
-    unordered_set<string> getTags()
+    const vector<TagHandle> &getTags() const
+    {
+        return tags;
+    }
+
+    void addAnswer(AnswerHandle A, Arena<Answer> &answerPool)
+    {
+        answers.push_back(A);
+        rankedAnswers.push_back(A);
+        answerPool[A].setRankPos(static_cast<uint32_t>(rankedAnswers.size() - 1));
+        reorderAnswer(A, answerPool);
+    }
+
+    // Moves A to its place in rankedAnswers after its score changed. A vote
+    // moves the score by at most two, so this is usually one or two swaps.
+    void reorderAnswer(AnswerHandle A, Arena<Answer> &answerPool)
     {
-        unordered_set<string> temp;
-        for (auto &T : tags)
+        auto ranksAbove = [&](AnswerHandle x, AnswerHandle y)
+        {
+            int sx = answerPool[x].getScore(), sy = answerPool[y].getScore();
+            return sx != sy ? sx > sy : x < y;
+        };
+        uint32_t pos = answerPool[A].getRankPos();
+        while (pos > 0 && ranksAbove(A, rankedAnswers[pos - 1]))
+        {
+            rankedAnswers[pos] = rankedAnswers[pos - 1];
+            answerPool[rankedAnswers[pos]].setRankPos(pos);
+            pos--;
+        }
+        while (pos + 1 < rankedAnswers.size() && ranksAbove(rankedAnswers[pos + 1], A))
         {
-            temp.insert(T->getTag());
+            rankedAnswers[pos] = rankedAnswers[pos + 1];
+            answerPool[rankedAnswers[pos]].setRankPos(pos);
+            pos++;
         }
-        return temp;
+        rankedAnswers[pos] = A;
+        answerPool[A].setRankPos(pos);
     }
 
-    shared_ptr<Answer> addAnswer(shared_ptr<User> U, const string &anstext)
+    // Rebuilds rankedAnswers from scratch, for when many scores changed at
+    // once (bulk import).
+    void sortAnswers(Arena<Answer> &answerPool)
     {
-        string ansId = generateRandomString();
-        auto A = make_shared<Answer>(ansId, anstext, U);
-        answers.push_back(A);
-        return A;
+        rankedAnswers = answers;
+        stable_sort(rankedAnswers.begin(), rankedAnswers.end(), [&](AnswerHandle x, AnswerHandle y)
+                    { return answerPool[x].getScore() > answerPool[y].getScore(); });
+        for (uint32_t pos = 0; pos < rankedAnswers.size(); ++pos)
+        {
+            answerPool[rankedAnswers[pos]].setRankPos(pos);
+        }
     }
 
-    vector<shared_ptr<Answer>> getAnswers()
+    // Answers in the order they were posted.
+    const vector<AnswerHandle> &getAnswers() const
     {
         return answers;
     }
 
-    void addVote(shared_ptr<User> U, voteType V)
+    Slice<AnswerHandle> getAnswers(size_t offset, size_t limit) const
+    {
+        return pageOf(answers, offset, limit);
+    }
+
+    // One page of answers, highest score first.
+    Slice<AnswerHandle> getTopAnswers(size_t offset, size_t limit) const
+    {
+        return pageOf(rankedAnswers, offset, limit);
+    }
+
+    size_t getAnswerCount() const
+    {
+        return answers.size();
+    }
+
+    // Toggles U's vote and returns how the counts moved; the caller turns
+    // that into reputation.
+    VoteChange addVote(UserHandle U, voteType V, Arena<Vote> &votePool)
     {
+        VoteChange change;
         for (auto it = votes.begin(); it != votes.end(); ++it)
         {
-            if ((*it)->getuser() == U)
+            Vote &vote = votePool[*it];
+            change.examined++;
+            if (vote.getuser() == U)
             {
-                if ((*it)->getVoteType() == V)
+                if (vote.getVoteType() == V)
                 {
                     if (V == voteType::Upvote)
                     {
                         upVote--;
-                        user->addReputation(-REPUTATION_FOR_QUESTION_UPVOTE);
+                        change.up--;
                     }
                     else
                     {
                         downVote--;
-                        user->reduceReputation(REPUTATION_FOR_DOWNVOTE);
+                        change.down--;
                     }
+                    votePool.release(*it);
                     votes.erase(it); // Erase the vote object
-                    return;
+                    return change;
                 }
                 else
                 {
-                    (*it)->alterVote();
+                    vote.alterVote();
                     if (V == voteType::Upvote)
                     {
                         upVote++;
-                        user->addReputation(REPUTATION_FOR_QUESTION_UPVOTE);
+                        change.up++;
                         downVote--;
-                        user->reduceReputation(REPUTATION_FOR_DOWNVOTE);
+                        change.down--;
                     }
                     else
                     {
                         upVote--;
-                        user->addReputation(-REPUTATION_FOR_QUESTION_UPVOTE);
+                        change.up--;
                         downVote++;
-                        user->reduceReputation(-REPUTATION_FOR_DOWNVOTE);
+                        change.down++;
                     }
-                    return;
+                    return change;
                 }
             }
         }
         // If user hasn't voted yet, add new vote
-        auto newVote = make_shared<Vote>(U, V);
-        votes.push_back(newVote);
+        votes.push_back(votePool.emplace(U, V));
+        if (V == voteType::Upvote)
+        {
+            upVote++;
+            change.up++;
+        }
+        else
+        {
+            downVote++;
+            change.down++;
+        }
+        return change;
+    }
+
+    // U's current vote on this post, or nullptr.
+    const Vote *findVote(UserHandle U, const Arena<Vote> &votePool) const
+    {
+        for (VoteHandle v : votes)
+        {
+            if (votePool[v].getuser() == U)
+            {
+                return &votePool[v];
+            }
+        }
+        return nullptr;
+    }
+
+    const vector<VoteHandle> &getVotes() const
+    {
+        return votes;
+    }
+
+    // Re-attaches a stored vote without touching reputation (snapshot load).
+    void restoreVote(VoteHandle vote, voteType V)
+    {
+        votes.push_back(vote);
         if (V == voteType::Upvote)
         {
             upVote++;
-            user->addReputation(REPUTATION_FOR_QUESTION_UPVOTE);
         }
         else
         {
             downVote++;
-            user->reduceReputation(REPUTATION_FOR_DOWNVOTE);
         }
     }
 
-    int getUpvote()
+    // Votes known only as totals (imported dumps do not say who voted).
+    // They count towards the score but cannot be toggled by anyone.
+    void addAnonymousVotes(int up, int down)
+    {
+        upVote += up;
+        downVote += down;
+    }
+
+    int getUpvote() const
     {
         return upVote;
     }
 
-    int getDownVote()
+    int getDownVote() const
     {
         return downVote;
     }
 
-    void addComment(shared_ptr<User> U, const string &commentText)
+    void addComment(CommentHandle C)
     {
-        string cId = generateRandomString();
-        auto newComment = make_shared<Comments>(cId, commentText, U);
-        comments.push_back(newComment);
+        comments.push_back(C);
     }
 
-    void addCommentOnAnswer(shared_ptr<User> U, shared_ptr<Answer> A, const string &commentText)
+    const vector<CommentHandle> &getComments() const
     {
-        if (find(answers.begin(), answers.end(), A) == answers.end())
-        {
-            return;
-        }
-        A->addComment(U, commentText);
+        return comments;
     }
 
-    vector<shared_ptr<Comments>> getComments(){
-        return comments;
+    Slice<CommentHandle> getComments(size_t offset, size_t limit) const
+    {
+        return pageOf(comments, offset, limit);
+    }
+
+    size_t heapBytes() const
+    {
+        return ownedBytes(answers) + ownedBytes(rankedAnswers) + ownedBytes(tags) + ownedBytes(votes) + ownedBytes(comments);
     }
 };
 
+// Mutations recorded in the event log, one record per successful call.
+enum class LogOp : uint8_t
+{
+    CreateUser = 1,
+    CreateTag,
+    AddTag,
+    AddQuestion,
+    AnswerQuestion,
+    VoteOnQuestion,
+    VoteOnAnswer,
+    CommentOnQuestion,
+    CommentOnAnswer
+};
+
+const uint32_t SNAPSHOT_MAGIC = 0x534F5631; // "SOV1"
+const uint32_t SNAPSHOT_VERSION = 8;
+
+// Stands in for an id attribute a dump row does not have (ownerless posts,
+// comments by removed users); real dump ids include -1 (Community).
+const int64_t DUMP_NO_ID = INT64_MIN;
+
+// Imported posts whose owner is not among the imported users are credited
+// to this user. createUser refuses the name, so it cannot be taken.
+const char *const DELETED_USER_NAME = "[deleted]";
+
+// Rows of a Stack Exchange data dump, decoded off the parsing threads.
+struct DumpUserRow
+{
+    int64_t id;
+    string name;
+};
+
+struct DumpPostRow
+{
+    int64_t id;
+    int64_t parentId;
+    int64_t ownerId;
+    int type; // 1 = question, 2 = answer
+    double time;
+    string text;
+    vector<string> tags;
+};
+
+struct DumpCommentRow
+{
+    int64_t postId;
+    int64_t userId;
+    double time;
+    string text;
+};
+
+struct DumpVoteRow
+{
+    int64_t postId;
+    bool up;
+};
+
+struct ImportStats
+{
+    size_t users = 0;
+    size_t questions = 0;
+    size_t answers = 0;
+    size_t comments = 0;
+    size_t votes = 0;
+    size_t skipped = 0; // rows referring to posts that are not in the dump
+};
+
+// Public calls that keep a latency histogram (see exportMetrics).
+enum class Operation
+{
+    AddQuestion,
+    AnswerQuestion,
+    Vote,
+    Comment,
+    FindQuestion,
+    SearchQuestions,
+    FindDuplicates,
+    ApplyBatch,
+    Count
+};
+
+const char *const OPERATION_NAMES[] = {"add_question", "answer_question", "vote", "comment",
+                                       "find_question", "search_questions", "find_duplicates", "apply_batch"};
+
+// A mutation queued on a WritePipeline. `target` is the question (or the
+// answer for VoteOnAnswer); CommentOnAnswer also names the answer.
+enum class CommandKind : uint8_t
+{
+    AddQuestion,
+    AddTag,
+    AnswerQuestion,
+    VoteOnQuestion,
+    VoteOnAnswer,
+    CommentOnQuestion,
+    CommentOnAnswer
+};
+
+struct Command
+{
+    CommandKind kind = CommandKind::VoteOnQuestion;
+    UserHandle user = INVALID_HANDLE;
+    Handle target = INVALID_HANDLE;
+    AnswerHandle answer = INVALID_HANDLE;
+    voteType vote = voteType::Upvote;
+    string text;
+    function<void(Handle)> done; // called with the created handle, if any
+    Handle result = INVALID_HANDLE;
+
+    Command() = default;
+    Command(CommandKind kind, UserHandle user, Handle target, AnswerHandle answer = INVALID_HANDLE,
+            voteType vote = voteType::Upvote, string text = string(), function<void(Handle)> done = nullptr)
+        : kind(kind), user(user), target(target), answer(answer), vote(vote), text(move(text)), done(move(done)) {}
+};
+
 class StackOverflow
 {
 private:
-    vector<shared_ptr<Question>> questions;
-    vector<shared_ptr<User>> user;
-    unordered_set<string> userCheck;
+    Arena<User> users;
+    Arena<Tags> tags;
+    Arena<Vote> votes;
+    Arena<Comments> comments;
+    Arena<Answer> answers;
+    Arena<Question> questions;
+    // Post bodies are packed per entity type so scans over one kind of text
+    // stay sequential.
+    TextPool questionTexts;
+    TextPool answerTexts;
+    TextPool commentTexts;
+    // Every reputation change; User::getReputation() is its running total.
+    ReputationLedger reputationLedger{reputationWeights()};
+    unordered_map<string, UserHandle> userByName;
+    // Accounts created by importDump, by Stack Exchange user id, so a
+    // repeat import credits the same accounts whatever their names.
+    unordered_map<int64_t, UserHandle> userByDumpId;
+    unordered_map<string, TagHandle> tagByName;
+    unordered_map<PostId, PostRef> postIndex;
+    SearchIndex searchIndex;
+    // Type-ahead for the search box: tags by usage, usernames by reputation.
+    Autocomplete tagCompletion;
+    Autocomplete userCompletion;
+    HotFeed hotFeed;
+    DuplicateIndex duplicates;
+    mutable QueryCache findCache; // internally locked, so const readers may fill it
 
-public:
-    // creating user
-    shared_ptr<User> createUser(string uname, string name)
+    // Instrumentation; histograms record without locks, so const readers
+    // record too.
+    mutable Histogram latency[static_cast<size_t>(Operation::Count)];
+    mutable Histogram findScanLength;   // questions examined per uncached findQuestion
+    mutable Histogram searchScanLength; // documents scored per searchQuestions
+    mutable Histogram voteScanLength;   // votes examined per vote call
+
+    // Persistence (see open()). Each snapshot starts a new log generation;
+    // the snapshot plus its generation's log is the full state.
+    string storageDir;
+    EventLog eventLog;
+    uint64_t logGeneration = 0;
+    uint64_t eventsSinceCheckpoint = 0;
+    uint64_t checkpointEvery = 0;
+    bool inBatch = false; // holds automatic checkpoints back until a batch is whole
+    // Cold storage for post bodies (see setColdStorage); 0 keeps all resident.
+    size_t coldResidentBytes = 0;
+    size_t coldCacheBytes = 0;
+
+    string snapshotPath() const
     {
-        if (userCheck.find(uname) == userCheck.end())
-        {
-            auto U = make_shared<User>(uname, name);
-            user.push_back(U);
-            userCheck.insert(uname);
-            return U;
-        }
-        else
-        {
-            cout << "Username already exits, please change username" << endl;
-            return nullptr;
-        }
+        return storageDir + "/snapshot";
     }
 
-    shared_ptr<Question> addQuestion(shared_ptr<User> U, const string &text)
+    string logPath(uint64_t generation) const
     {
-        string rndId = generateRandomString();
-        auto Q = make_shared<Question>(rndId, text, U);
-        U->addReputation(REPUTATION_FOR_QUESTION);
-        questions.push_back(Q);
-        return Q;
+        return storageDir + "/events." + to_string(generation) + ".log";
     }
 
-    unordered_set<shared_ptr<Question>> findQuestion(string key)
+    static double nowSeconds()
     {
-        unordered_set<shared_ptr<Question>> response;
-        string lowerKey = toLower(key);
+        return chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+    }
 
-        for (auto &Q : questions)
+    // Called before the mutation is applied, so a due checkpoint is taken
+    // first and captures a state that excludes this record.
+    void logEvent(const BinaryWriter &record)
+    {
+        if (checkpointEvery != 0 && eventsSinceCheckpoint >= checkpointEvery && !inBatch)
         {
-            if (toLower(Q->getQuestionText()).find(lowerKey) != string::npos)
-            {
-                response.insert(Q);
-                continue;
-            }
-            if (toLower(Q->getUsername()).find(lowerKey) != string::npos)
-            {
-                response.insert(Q);
-                continue;
-            }
-            auto tags = Q->getTags();
-            for (const auto &tag : tags)
-            {
-                if (toLower(tag).find(lowerKey) != string::npos)
-                {
-                    response.insert(Q);
-                    break;
-                }
-            }
+            checkpoint();
         }
-        return response;
+        eventLog.append(record.bytes());
+        eventsSinceCheckpoint++;
     }
 
-    shared_ptr<Answer> answerQuestion(shared_ptr<User> U, shared_ptr<Question> Q, const string &answerText)
+    void logVote(LogOp op, UserHandle U, Handle post, voteType V, double time)
     {
-        shared_ptr<Answer> ans = Q->addAnswer(U, answerText);
-        U->addReputation(REPUTATION_FOR_ANSWER);
-        return ans;
-    };
+        if (eventLog.isOpen())
+        {
+            BinaryWriter record;
+            record.put(op);
+            record.put(U);
+            record.put(post);
+            record.put(V);
+            record.put(time);
+            logEvent(record);
+        }
+    }
 
-    void addCommentOnQuestion(shared_ptr<User> U, shared_ptr<Question> Q, string commentText)
+    // Keeps the ranking boost of a question in step with its votes and answers.
+    void refreshSearchBoost(QuestionHandle Q)
     {
-        string trimmed = commentText;
-        trimmed.erase(remove_if(trimmed.begin(), trimmed.end(), ::isspace), trimmed.end());
+        const Question &question = questions[Q];
+        int score = question.getUpvote() - question.getDownVote();
+        double voteBoost = copysign(log1p(abs(score)), score);
+        searchIndex.setBoost(Q, SEARCH_VOTE_WEIGHT * voteBoost + SEARCH_ANSWER_WEIGHT * log1p(question.getAnswerCount()));
+    }
 
-        if (trimmed.empty())
+    Histogram &latencyOf(Operation op) const
+    {
+        return latency[static_cast<size_t>(op)];
+    }
+
+    void refreshUserCompletion(UserHandle U)
+    {
+        userCompletion.setWeight(users[U].getUsername(), U, users[U].getReputation());
+    }
+
+    // Records the reputation effect of a vote call on a post by `author`
+    // and returns the points, which the caller adds to the author.
+    int recordVote(UserHandle author, Handle post, bool onAnswer, VoteChange change)
+    {
+        ReputationReason up = onAnswer ? ReputationReason::AnswerUpvote : ReputationReason::QuestionUpvote;
+        ReputationReason down = onAnswer ? ReputationReason::AnswerDownvote : ReputationReason::QuestionDownvote;
+        return reputationLedger.record(author, post, up, change.up) + reputationLedger.record(author, post, down, change.down);
+    }
+
+    // The apply* functions perform a mutation that has already been
+    // validated. Live calls and log replay both go through them, with ids and
+    // timestamps taken from the log on replay.
+
+    UserHandle applyCreateUser(const string &uname, const string &name)
+    {
+        UserHandle U = users.emplace(uname, name);
+        userByName.emplace(uname, U);
+        refreshUserCompletion(U);
+        return U;
+    }
+
+    TagHandle applyCreateTag(const string &tagName)
+    {
+        TagHandle T = tags.emplace(tagName);
+        tagByName.emplace(tagName, T);
+        tagCompletion.setWeight(tagName, T, 0);
+        return T;
+    }
+
+    void applyAddTag(QuestionHandle Q, const string &tagName)
+    {
+        auto it = tagByName.find(tagName);
+        TagHandle T = it != tagByName.end() ? it->second : applyCreateTag(tagName);
+        if (!questions[Q].addTag(T))
+        {
+            return;
+        }
+        tags[T].addUsage();
+        tagCompletion.setWeight(tagName, T, tags[T].getUsageCount());
+        searchIndex.addTag(Q, tagName);
+        findCache.invalidateMatching(toLower(tagName), Q);
+    }
+
+    // Ids come from newPostId (or the log, which recorded them), so they are
+    // unique; a clash would leave a post unreachable by id.
+    void indexPost(PostId id, PostRef ref)
+    {
+        bool inserted = postIndex.emplace(id, ref).second;
+        assert(inserted && "post id already in use");
+        (void)inserted;
+    }
+
+    // A fresh snowflake id, skipping any that a restored snapshot or an
+    // imported dump already uses.
+    PostId newPostId() const
+    {
+        PostId id = IdGenerator::next();
+        while (postIndex.count(id))
+        {
+            id = IdGenerator::next();
+        }
+        return id;
+    }
+
+    QuestionHandle applyAddQuestion(UserHandle U, string_view text, PostId id, double time)
+    {
+        QuestionHandle Q = questions.emplace(id, questionTexts.add(text), U);
+        indexPost(id, PostRef{PostKind::Question, Q});
+        users[U].addQuestion(Q);
+        users[U].addReputation(reputationLedger.record(U, Q, ReputationReason::Question, 1));
+        refreshUserCompletion(U);
+        searchIndex.addDocument(Q, text);
+        duplicates.addDocument(Q, text);
+        hotFeed.record(Q, HOT_WEIGHT_QUESTION, time);
+        // The separator keeps keys from matching across text and name.
+        findCache.invalidateMatching(toLower(text) + '\0' + toLower(users[U].getName()), Q);
+        return Q;
+    }
+
+    AnswerHandle applyAnswerQuestion(UserHandle U, QuestionHandle Q, string_view answerText, PostId id, double time)
+    {
+        AnswerHandle A = answers.emplace(id, answerTexts.add(answerText), U, Q);
+        indexPost(id, PostRef{PostKind::Answer, A});
+        questions[Q].addAnswer(A, answers);
+        users[U].addAnswer(A);
+        users[U].addReputation(reputationLedger.record(U, A, ReputationReason::Answer, 1));
+        refreshUserCompletion(U);
+        refreshSearchBoost(Q);
+        hotFeed.record(Q, HOT_WEIGHT_ANSWER, time);
+        return A;
+    }
+
+    void applyVoteOnQuestion(UserHandle U, QuestionHandle Q, voteType V, double time)
+    {
+        int before = questions[Q].getUpvote() - questions[Q].getDownVote();
+        UserHandle author = questions[Q].getUser();
+        VoteChange change = questions[Q].addVote(U, V, votes);
+        voteScanLength.record(change.examined);
+        users[author].addReputation(recordVote(author, Q, false, change));
+        users[U].addVoteCast({questions[Q].getQuestionId(), V, change.action()});
+        int after = questions[Q].getUpvote() - questions[Q].getDownVote();
+        refreshUserCompletion(author);
+        refreshSearchBoost(Q);
+        hotFeed.record(Q, HOT_WEIGHT_VOTE * (after - before), time);
+    }
+
+    void applyVoteOnAnswer(UserHandle U, AnswerHandle A, voteType V, double time)
+    {
+        QuestionHandle Q = answers[A].getQuestion();
+        int before = answers[A].getScore();
+        UserHandle author = answers[A].getUser();
+        VoteChange change = answers[A].addVote(U, V, votes);
+        voteScanLength.record(change.examined);
+        users[author].addReputation(recordVote(author, A, true, change));
+        users[U].addVoteCast({answers[A].getAnswerId(), V, change.action()});
+        questions[Q].reorderAnswer(A, answers);
+        refreshUserCompletion(author);
+        refreshSearchBoost(Q);
+        hotFeed.record(Q, HOT_WEIGHT_VOTE * (answers[A].getScore() - before), time);
+    }
+
+    CommentHandle createComment(UserHandle U, TextRef commentText, PostId id)
+    {
+        CommentHandle C = comments.emplace(id, commentText, U);
+        indexPost(id, PostRef{PostKind::Comment, C});
+        users[U].addComment(C);
+        return C;
+    }
+
+    void applyCommentOnQuestion(UserHandle U, QuestionHandle Q, string_view commentText, PostId id, double time)
+    {
+        questions[Q].addComment(createComment(U, commentTexts.add(commentText), id));
+        hotFeed.record(Q, HOT_WEIGHT_COMMENT, time);
+    }
+
+    void applyCommentOnAnswer(UserHandle U, AnswerHandle A, string_view commentText, PostId id, double time)
+    {
+        answers[A].addComment(createComment(U, commentTexts.add(commentText), id));
+        hotFeed.record(answers[A].getQuestion(), HOT_WEIGHT_COMMENT, time);
+    }
+
+    bool replayEvent(BinaryReader &in)
+    {
+        LogOp op = in.get<LogOp>();
+        switch (op)
+        {
+        case LogOp::CreateUser:
+        {
+            string uname(in.getString());
+            string name(in.getString());
+            applyCreateUser(uname, name);
+            break;
+        }
+        case LogOp::CreateTag:
+            applyCreateTag(string(in.getString()));
+            break;
+        case LogOp::AddTag:
+        {
+            QuestionHandle Q = in.get<QuestionHandle>();
+            applyAddTag(Q, string(in.getString()));
+            break;
+        }
+        case LogOp::AddQuestion:
+        {
+            UserHandle U = in.get<UserHandle>();
+            PostId id = in.get<PostId>();
+            double time = in.get<double>();
+            applyAddQuestion(U, in.getString(), id, time);
+            break;
+        }
+        case LogOp::AnswerQuestion:
+        {
+            UserHandle U = in.get<UserHandle>();
+            QuestionHandle Q = in.get<QuestionHandle>();
+            PostId id = in.get<PostId>();
+            double time = in.get<double>();
+            applyAnswerQuestion(U, Q, in.getString(), id, time);
+            break;
+        }
+        case LogOp::VoteOnQuestion:
+        {
+            UserHandle U = in.get<UserHandle>();
+            QuestionHandle Q = in.get<QuestionHandle>();
+            voteType V = in.get<voteType>();
+            applyVoteOnQuestion(U, Q, V, in.get<double>());
+            break;
+        }
+        case LogOp::VoteOnAnswer:
+        {
+            UserHandle U = in.get<UserHandle>();
+            AnswerHandle A = in.get<AnswerHandle>();
+            voteType V = in.get<voteType>();
+            applyVoteOnAnswer(U, A, V, in.get<double>());
+            break;
+        }
+        case LogOp::CommentOnQuestion:
+        {
+            UserHandle U = in.get<UserHandle>();
+            QuestionHandle Q = in.get<QuestionHandle>();
+            PostId id = in.get<PostId>();
+            double time = in.get<double>();
+            applyCommentOnQuestion(U, Q, in.getString(), id, time);
+            break;
+        }
+        case LogOp::CommentOnAnswer:
+        {
+            UserHandle U = in.get<UserHandle>();
+            AnswerHandle A = in.get<AnswerHandle>();
+            PostId id = in.get<PostId>();
+            double time = in.get<double>();
+            applyCommentOnAnswer(U, A, in.getString(), id, time);
+            break;
+        }
+        default:
+            return false;
+        }
+        return !in.failed();
+    }
+
+    template <typename Post>
+    void saveVotes(BinaryWriter &out, const Post &post) const
+    {
+        out.put<int32_t>(post.getUpvote());
+        out.put<int32_t>(post.getDownVote());
+        out.put<uint32_t>(static_cast<uint32_t>(post.getVotes().size()));
+        for (VoteHandle vh : post.getVotes())
+        {
+            out.put<UserHandle>(votes[vh].getuser());
+            out.put<voteType>(votes[vh].getVoteType());
+        }
+    }
+
+    template <typename Post>
+    bool loadVotes(BinaryReader &in, Post &post)
+    {
+        int32_t up = in.get<int32_t>();
+        int32_t down = in.get<int32_t>();
+        uint32_t n = in.get<uint32_t>();
+        for (uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            UserHandle U = in.get<UserHandle>();
+            voteType V = in.get<voteType>();
+            if (U >= users.size())
+            {
+                return false;
+            }
+            post.restoreVote(votes.emplace(U, V), V);
+        }
+        post.addAnonymousVotes(up - post.getUpvote(), down - post.getDownVote());
+        return true;
+    }
+
+    static void saveHandles(BinaryWriter &out, const vector<Handle> &handles)
+    {
+        out.put<uint32_t>(static_cast<uint32_t>(handles.size()));
+        out.putBytes(handles.data(), handles.size() * sizeof(Handle));
+    }
+
+    // False if the list is cut short or names a handle at or past limit.
+    static bool loadHandles(BinaryReader &in, size_t limit, vector<Handle> &handles)
+    {
+        uint32_t n = in.get<uint32_t>();
+        const Handle *first = static_cast<const Handle *>(in.getBytes(n * sizeof(Handle)));
+        if (in.failed())
+        {
+            return false;
+        }
+        handles.assign(first, first + n);
+        return all_of(handles.begin(), handles.end(), [&](Handle h)
+                      { return h < limit; });
+    }
+
+    void saveSnapshot(BinaryWriter &out) const
+    {
+        out.put<uint32_t>(SNAPSHOT_MAGIC);
+        out.put<uint32_t>(SNAPSHOT_VERSION);
+        out.put<uint64_t>(logGeneration);
+
+        out.put<uint32_t>(users.size());
+        for (UserHandle U = 0; U < users.size(); ++U)
+        {
+            out.putString(users[U].getUsername());
+            out.putString(users[U].getName());
+        }
+        out.put<uint32_t>(userByDumpId.size());
+        for (const auto &[id, U] : userByDumpId)
+        {
+            out.put<int64_t>(id);
+            out.put<UserHandle>(U);
+        }
+        out.put<uint32_t>(tags.size());
+        for (TagHandle T = 0; T < tags.size(); ++T)
+        {
+            out.putString(tags[T].getTag());
+            out.put<int32_t>(tags[T].getUsageCount());
+        }
+        // Bodies are stored pool by pool and the posts keep their TextRefs.
+        questionTexts.save(out);
+        answerTexts.save(out);
+        commentTexts.save(out);
+        out.put<uint32_t>(comments.size());
+        for (CommentHandle C = 0; C < comments.size(); ++C)
+        {
+            out.put<PostId>(comments[C].getCommentId());
+            out.put<UserHandle>(comments[C].getUser());
+            out.put<TextRef>(comments[C].getCommentText());
+        }
+        out.put<uint32_t>(questions.size());
+        for (QuestionHandle Q = 0; Q < questions.size(); ++Q)
+        {
+            const Question &question = questions[Q];
+            out.put<PostId>(question.getQuestionId());
+            out.put<UserHandle>(question.getUser());
+            out.put<TextRef>(question.getQuestionText());
+            saveHandles(out, question.getTags());
+            saveHandles(out, question.getComments());
+            saveVotes(out, question);
+        }
+        out.put<uint32_t>(answers.size());
+        for (AnswerHandle A = 0; A < answers.size(); ++A)
+        {
+            const Answer &answer = answers[A];
+            out.put<PostId>(answer.getAnswerId());
+            out.put<UserHandle>(answer.getUser());
+            out.put<QuestionHandle>(answer.getQuestion());
+            out.put<TextRef>(answer.getAnswerText());
+            saveHandles(out, answer.getComments());
+            saveVotes(out, answer);
+        }
+        // Post activity is rebuilt from the posts on load; only the vote
+        // history has to be stored.
+        for (UserHandle U = 0; U < users.size(); ++U)
+        {
+            const vector<VoteRecord> &cast = users[U].getVotesCast();
+            out.put<uint32_t>(cast.size());
+            for (const VoteRecord &vote : cast)
+            {
+                out.put<PostId>(vote.post);
+                out.put<voteType>(vote.type);
+                out.put<VoteAction>(vote.action);
+            }
+        }
+        reputationLedger.save(out);
+        searchIndex.save(out);
+        duplicates.save(out);
+        hotFeed.save(out);
+        out.put<uint32_t>(SNAPSHOT_MAGIC);
+        // Trailer: CRC-32 of everything above, checked before parsing.
+        out.put<uint32_t>(out.checksum());
+    }
+
+    bool loadSnapshot(BinaryReader &in)
+    {
+        if (in.get<uint32_t>() != SNAPSHOT_MAGIC || in.get<uint32_t>() != SNAPSHOT_VERSION)
+        {
+            return false;
+        }
+        logGeneration = in.get<uint64_t>();
+
+        uint32_t n = in.get<uint32_t>();
+        for (uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            string uname(in.getString());
+            string name(in.getString());
+            UserHandle U = users.emplace(uname, name);
+            userByName.emplace(uname, U);
+        }
+        n = in.get<uint32_t>();
+        for (uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            int64_t id = in.get<int64_t>();
+            UserHandle U = in.get<UserHandle>();
+            if (U >= users.size())
+            {
+                return false;
+            }
+            userByDumpId.emplace(id, U);
+        }
+        n = in.get<uint32_t>();
+        for (uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            string tagName(in.getString());
+            TagHandle T = tags.emplace(tagName, in.get<int32_t>());
+            tagByName.emplace(tagName, T);
+            tagCompletion.setWeight(tagName, T, tags[T].getUsageCount());
+        }
+        if (!questionTexts.load(in) || !answerTexts.load(in) || !commentTexts.load(in))
+        {
+            return false;
+        }
+        n = in.get<uint32_t>();
+        for (uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            PostId id = in.get<PostId>();
+            UserHandle U = in.get<UserHandle>();
+            TextRef text = in.get<TextRef>();
+            if (postIndex.count(id) || U >= users.size() || !commentTexts.contains(text))
+            {
+                return false;
+            }
+            createComment(U, text, id);
+        }
+        n = in.get<uint32_t>();
+        for (uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            PostId id = in.get<PostId>();
+            UserHandle U = in.get<UserHandle>();
+            TextRef text = in.get<TextRef>();
+            if (U >= users.size() || !questionTexts.contains(text))
+            {
+                return false;
+            }
+            QuestionHandle Q = questions.emplace(id, text, U);
+            if (!postIndex.emplace(id, PostRef{PostKind::Question, Q}).second)
+            {
+                return false;
+            }
+            users[U].addQuestion(Q);
+            vector<Handle> tagList, commentList;
+            if (!loadHandles(in, tags.size(), tagList) || !loadHandles(in, comments.size(), commentList) || !loadVotes(in, questions[Q]))
+            {
+                return false;
+            }
+            for (TagHandle T : tagList)
+            {
+                questions[Q].addTag(T);
+            }
+            for (CommentHandle C : commentList)
+            {
+                questions[Q].addComment(C);
+            }
+        }
+        n = in.get<uint32_t>();
+        for (uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            PostId id = in.get<PostId>();
+            UserHandle U = in.get<UserHandle>();
+            QuestionHandle Q = in.get<QuestionHandle>();
+            TextRef text = in.get<TextRef>();
+            if (U >= users.size() || Q >= questions.size() || !answerTexts.contains(text))
+            {
+                return false;
+            }
+            AnswerHandle A = answers.emplace(id, text, U, Q);
+            if (!postIndex.emplace(id, PostRef{PostKind::Answer, A}).second)
+            {
+                return false;
+            }
+            users[U].addAnswer(A);
+            vector<Handle> commentList;
+            if (!loadHandles(in, comments.size(), commentList) || !loadVotes(in, answers[A]))
+            {
+                return false;
+            }
+            for (CommentHandle C : commentList)
+            {
+                answers[A].addComment(C);
+            }
+            questions[Q].addAnswer(A, answers);
+        }
+        for (UserHandle U = 0; U < users.size() && !in.failed(); ++U)
+        {
+            n = in.get<uint32_t>();
+            for (uint32_t i = 0; i < n && !in.failed(); ++i)
+            {
+                PostId post = in.get<PostId>();
+                voteType type = in.get<voteType>();
+                users[U].addVoteCast({post, type, in.get<VoteAction>()});
+            }
+        }
+        if (!reputationLedger.load(in, users.size()) || !searchIndex.load(in, questions.size()) ||
+            !duplicates.load(in, questions.size(), max(1u, thread::hardware_concurrency())) || !hotFeed.load(in, questions.size()))
+        {
+            return false;
+        }
+        // Reputation is not stored: it is summed from the ledger under the
+        // current REPUTATION_FOR_* weights.
+        vector<int> reputation = reputationLedger.totals(users.size(), max(1u, thread::hardware_concurrency()));
+        for (UserHandle U = 0; U < users.size(); ++U)
+        {
+            users[U].setReputation(reputation[U]);
+            refreshUserCompletion(U);
+        }
+        return in.get<uint32_t>() == SNAPSHOT_MAGIC && !in.failed();
+    }
+
+    // Bulk-import counterparts of applyCreateUser/applyCreateTag: no
+    // completion updates, those are rebuilt once at the end.
+    UserHandle bulkCreateUser(const string &uname, const string &name)
+    {
+        if (userByName.count(uname))
+        {
+            return INVALID_HANDLE;
+        }
+        UserHandle U = users.emplace(uname, name);
+        userByName.emplace(uname, U);
+        return U;
+    }
+
+    TagHandle bulkCreateTag(const string &tagName)
+    {
+        auto it = tagByName.find(tagName);
+        if (it != tagByName.end())
+        {
+            return it->second;
+        }
+        TagHandle T = tags.emplace(tagName);
+        tagByName.emplace(tagName, T);
+        return T;
+    }
+
+    // Calls fn(first, texts) for the texts of questions [begin, end), a
+    // window of about TEXT_WINDOW_BYTES at a time; the views are valid
+    // during the call.
+    template <typename Fn>
+    void forQuestionTexts(QuestionHandle begin, QuestionHandle end, Fn fn) const
+    {
+        vector<PinnedText> pins;
+        vector<string_view> texts;
+        size_t bytes = 0;
+        QuestionHandle first = begin;
+        for (QuestionHandle Q = begin; Q < end; ++Q)
+        {
+            pins.push_back(questionTexts.get(questions[Q].getQuestionText()));
+            texts.push_back(pins.back());
+            bytes += pins.back().size();
+            if (bytes >= TEXT_WINDOW_BYTES || Q + 1 == end)
+            {
+                fn(first, texts);
+                pins.clear();
+                texts.clear();
+                bytes = 0;
+                first = Q + 1;
+            }
+        }
+    }
+
+    // findQuestion over questions [begin, end), given which authors and tags
+    // already match. Question texts sit back to back in their pool, so each
+    // run of texts sharing a storage unit (a resident chunk or a cold block)
+    // is scanned as one block and every hit is mapped back to its question
+    // by offset; a hit straddling two texts is not a match.
+    void scanQuestions(const CaseInsensitiveFinder &finder, QuestionHandle begin, QuestionHandle end,
+                       const vector<char> &userHit, const vector<char> &tagHit, vector<QuestionHandle> &out) const
+    {
+        auto matchesOutsideText = [&](QuestionHandle Q)
+        {
+            if (userHit[questions[Q].getUser()])
+            {
+                return true;
+            }
+            for (TagHandle T : questions[Q].getTags())
+            {
+                if (tagHit[T])
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        QuestionHandle runBegin = begin;
+        while (runBegin < end)
+        {
+            TextRef first = questions[runBegin].getQuestionText();
+            uint64_t unit = questionTexts.unitOf(first);
+            QuestionHandle runEnd = runBegin + 1;
+            while (runEnd < end && questionTexts.unitOf(questions[runEnd].getQuestionText()) == unit)
+            {
+                ++runEnd;
+            }
+            // A sweep over cold blocks bypasses the block cache.
+            PinnedText run = questionTexts.span(first, questions[runEnd - 1].getQuestionText(), false);
+            string_view block = run;
+
+            QuestionHandle next = runBegin; // questions before next are decided
+            size_t pos = finder.find(block);
+            while (pos != string_view::npos)
+            {
+                // The last text of the run starting at or before the hit.
+                uint32_t at = first.offset + static_cast<uint32_t>(pos);
+                QuestionHandle lo = next, hi = runEnd;
+                while (hi - lo > 1)
+                {
+                    QuestionHandle mid = lo + (hi - lo) / 2;
+                    (questions[mid].getQuestionText().offset <= at ? lo : hi) = mid;
+                }
+                TextRef text = questions[lo].getQuestionText();
+                if (at + finder.size() > text.offset + text.length)
+                {
+                    pos = finder.find(block, pos + 1);
+                    continue;
+                }
+                for (; next < lo; ++next)
+                {
+                    if (matchesOutsideText(next))
+                    {
+                        out.push_back(next);
+                    }
+                }
+                out.push_back(lo);
+                next = lo + 1;
+                if (next == runEnd)
+                {
+                    break;
+                }
+                pos = finder.find(block, questions[next].getQuestionText().offset - first.offset);
+            }
+            for (; next < runEnd; ++next)
+            {
+                if (matchesOutsideText(next))
+                {
+                    out.push_back(next);
+                }
+            }
+            runBegin = runEnd;
+        }
+    }
+
+    // Derived state for everything added by importDump since the given
+    // handles: answer order, search postings and boosts, reputation and the
+    // autocomplete tries.
+    void rebuildAfterImport(UserHandle firstUser, QuestionHandle firstQuestion, AnswerHandle firstAnswer, unsigned threads)
+    {
+        threads = max(1u, threads);
+        size_t newQuestions = questions.size() - firstQuestion;
+        size_t newAnswers = answers.size() - firstAnswer;
+
+        // Answers of one question only touch that question's list, so
+        // questions can be sorted independently.
+        parallelRanges(questions.size(), threads, [&](size_t begin, size_t end)
+                       {
+                           for (size_t Q = begin; Q < end; ++Q)
+                           {
+                               questions[Q].sortAnswers(answers);
+                           } });
+
+        forQuestionTexts(firstQuestion, questions.size(), [&](QuestionHandle first, const vector<string_view> &texts)
+                         {
+                             searchIndex.addDocuments(first, texts, threads);
+                             duplicates.addDocuments(first, texts, threads); });
+        for (QuestionHandle Q = 0; Q < questions.size(); ++Q)
+        {
+            refreshSearchBoost(Q);
+        }
+
+        // Imported votes are totals per post, so each post gets one ledger
+        // entry per reason; the new entries are then summed per user.
+        size_t firstEntry = reputationLedger.size();
+        for (size_t i = 0; i < newQuestions; ++i)
+        {
+            QuestionHandle Q = firstQuestion + i;
+            const Question &q = questions[Q];
+            reputationLedger.record(q.getUser(), Q, ReputationReason::Question, 1);
+            recordVote(q.getUser(), Q, false, VoteChange{q.getUpvote(), q.getDownVote()});
+        }
+        for (size_t i = 0; i < newAnswers; ++i)
+        {
+            AnswerHandle A = firstAnswer + i;
+            const Answer &a = answers[A];
+            reputationLedger.record(a.getUser(), A, ReputationReason::Answer, 1);
+            recordVote(a.getUser(), A, true, VoteChange{a.getUpvote(), a.getDownVote()});
+        }
+        vector<int> earned = reputationLedger.totals(users.size(), threads, firstEntry);
+        for (UserHandle U = 0; U < users.size(); ++U)
+        {
+            users[U].addReputation(earned[U]);
+        }
+
+        for (UserHandle U = 0; U < users.size(); ++U)
+        {
+            if (U >= firstUser || users[U].getReputation() != 0)
+            {
+                refreshUserCompletion(U);
+            }
+        }
+        for (TagHandle T = 0; T < tags.size(); ++T)
+        {
+            tagCompletion.setWeight(tags[T].getTag(), T, tags[T].getUsageCount());
+        }
+    }
+
+public:
+    StackOverflow() = default;
+    StackOverflow(const StackOverflow &) = delete;
+    StackOverflow &operator=(const StackOverflow &) = delete;
+
+    // Keeps at most about residentBytes of each text pool (question, answer
+    // and comment bodies) in memory; older chunks are compressed into files
+    // next to the snapshot and read back through a cache of cacheBytes. The
+    // snapshot refers to those files rather than copying the text, so open()
+    // maps them back as they are. Call before open().
+    void setColdStorage(size_t residentBytes, size_t cacheBytes)
+    {
+        coldResidentBytes = residentBytes;
+        coldCacheBytes = cacheBytes;
+    }
+
+    // Makes this (empty) instance durable in directory: restores the latest
+    // snapshot, replays the event log written since, and from then on logs
+    // every mutation. The log is group-committed in the background, so a
+    // crash loses at most the last few milliseconds unless sync() was called.
+    // With checkpointEvery > 0 a snapshot is taken after that many events.
+    bool open(const string &directory, uint64_t checkpointEvery = 0)
+    {
+        storageDir = directory;
+        this->checkpointEvery = checkpointEvery;
+        ::mkdir(directory.c_str(), 0755);
+        // Even with cold storage off, chunks an earlier session moved out are
+        // still read from the files.
+        if (!(questionTexts.enableColdStorage(directory + "/questions.cold", coldResidentBytes, coldCacheBytes) &&
+              answerTexts.enableColdStorage(directory + "/answers.cold", coldResidentBytes, coldCacheBytes) &&
+              commentTexts.enableColdStorage(directory + "/comments.cold", coldResidentBytes, coldCacheBytes)))
+        {
+            cout << "Cannot open cold storage in " << directory << endl;
+            return false;
+        }
+
+        MappedFile snapshot;
+        if (snapshot.open(snapshotPath()) && snapshot.size() > 0)
+        {
+            uint32_t crc = 0;
+            size_t body = snapshot.size() - min(snapshot.size(), sizeof(crc));
+            memcpy(&crc, snapshot.data() + body, snapshot.size() - body);
+            BinaryReader in(snapshot.data(), body);
+            if (crc32(snapshot.data(), body) != crc || !loadSnapshot(in))
+            {
+                cout << "Snapshot in " << directory << " is corrupt" << endl;
+                return false;
+            }
+        }
+        snapshot.close();
+
+        size_t validBytes = 0;
+        bool replayed = true;
+        EventLog::replay(logPath(logGeneration), [&](BinaryReader &record)
+                         { replayed = replayed && replayEvent(record); },
+                         &validBytes);
+        if (!replayed)
+        {
+            cout << "Event log in " << directory << " is corrupt" << endl;
+            return false;
+        }
+        findCache.clear();
+        // Drop a torn tail left by a crash so new records follow valid ones.
+        ::truncate(logPath(logGeneration).c_str(), static_cast<off_t>(validBytes));
+        if (logGeneration > 0)
+        {
+            ::unlink(logPath(logGeneration - 1).c_str());
+        }
+        return eventLog.open(logPath(logGeneration));
+    }
+
+    // Writes a snapshot of all entities and indexes and starts a fresh log.
+    bool checkpoint()
+    {
+        if (!eventLog.isOpen())
+        {
+            return false;
+        }
+        eventLog.sync();
+        if (!questionTexts.sync() || !answerTexts.sync() || !commentTexts.sync())
+        {
+            cout << "Cold storage in " << storageDir << " cannot be synced" << endl;
+            return false;
+        }
+        logGeneration++;
+        SnapshotFile file(snapshotPath());
+        BinaryWriter out(file.descriptor());
+        saveSnapshot(out);
+        if (file.descriptor() < 0 || !out.flush() || !file.commit())
+        {
+            logGeneration--;
+            cout << "Snapshot to " << storageDir << " failed" << endl;
+            return false;
+        }
+        eventLog.close();
+        ::unlink(logPath(logGeneration - 1).c_str());
+        eventsSinceCheckpoint = 0;
+        return eventLog.open(logPath(logGeneration));
+    }
+
+    // Blocks until every mutation so far is on disk.
+    void sync()
+    {
+        if (eventLog.isOpen())
+        {
+            eventLog.sync();
+        }
+    }
+
+    // Loads a Stack Exchange data dump (Users.xml, Posts.xml, Comments.xml
+    // and Votes.xml from directory; only Posts.xml is required). Files are
+    // streamed in chunks whose rows are decoded on `threads` threads, then
+    // turned into entities without the per-call bookkeeping of the public
+    // mutators. Posts keep their dump ids; users become "user<Id>" (with a
+    // suffix if that name is taken) and are remembered by their dump id, and
+    // posts without a known owner go to DELETED_USER_NAME. Dump votes are
+    // anonymous, so they are added as vote totals. Search, ranking and
+    // reputation are rebuilt in parallel passes at the end. Imports are not
+    // written to the event log; if storage is open a checkpoint follows.
+    ImportStats importDump(const string &directory, unsigned threads = max(1u, thread::hardware_concurrency()))
+    {
+        ImportStats stats;
+        ChunkedFileReader postsFile(directory + "/Posts.xml");
+        if (!postsFile.isOpen())
+        {
+            cout << "No Posts.xml in " << directory << endl;
+            return stats;
+        }
+        UserHandle firstUser = users.size();
+        QuestionHandle firstQuestion = questions.size();
+        AnswerHandle firstAnswer = answers.size();
+        UserHandle ghost = INVALID_HANDLE;
+        auto ownerOf = [&](int64_t seId)
+        {
+            auto it = userByDumpId.find(seId);
+            if (it != userByDumpId.end())
+            {
+                return it->second;
+            }
+            // Posts by deleted accounts are attributed to one placeholder,
+            // shared with earlier imports.
+            if (ghost == INVALID_HANDLE)
+            {
+                auto existing = userByName.find(DELETED_USER_NAME);
+                ghost = existing != userByName.end() ? existing->second : bulkCreateUser(DELETED_USER_NAME, "deleted user");
+            }
+            return ghost;
+        };
+
+        string chunk;
+        ChunkedFileReader usersFile(directory + "/Users.xml");
+        while (usersFile.next(chunk))
+        {
+            auto rows = parseRowsParallel<DumpUserRow>(chunk, threads, [](const XmlRow &row, vector<DumpUserRow> &out)
+                                                       {
+                                                           DumpUserRow u{row.getInt("Id", DUMP_NO_ID), string()};
+                                                           appendXmlDecoded(row.get("DisplayName"), u.name);
+                                                           out.push_back(move(u)); });
+            for (auto &u : rows)
+            {
+                // Imported before: new posts still go to the same user.
+                if (u.id == DUMP_NO_ID || userByDumpId.count(u.id))
+                {
+                    continue;
+                }
+                // The name may belong to an account created through
+                // createUser; the dump user then gets a suffixed one.
+                string uname = "user" + to_string(u.id);
+                for (int n = 2; userByName.count(uname); ++n)
+                {
+                    uname = "user" + to_string(u.id) + "-" + to_string(n);
+                }
+                userByDumpId.emplace(u.id, bulkCreateUser(uname, u.name));
+                stats.users++;
+            }
+        }
+
+        // Comments and votes only attach to posts created by this import, so
+        // loading the same dump twice does not count them twice.
+        auto importedPost = [&](PostId id)
+        {
+            auto it = postIndex.find(id);
+            if (it == postIndex.end() || it->second.kind == PostKind::Comment)
+            {
+                return PostRef{};
+            }
+            Handle first = it->second.kind == PostKind::Question ? firstQuestion : firstAnswer;
+            return it->second.handle >= first ? it->second : PostRef{};
+        };
+
+        vector<DumpPostRow> orphanAnswers;
+        auto importAnswer = [&](DumpPostRow &p)
+        {
+            auto parent = postIndex.find(p.parentId);
+            if (postIndex.count(p.id) || parent == postIndex.end() || parent->second.kind != PostKind::Question)
+            {
+                return false;
+            }
+            QuestionHandle Q = parent->second.handle;
+            UserHandle U = ownerOf(p.ownerId);
+            AnswerHandle A = answers.emplace(p.id, answerTexts.add(p.text), U, Q);
+            indexPost(p.id, PostRef{PostKind::Answer, A});
+            users[U].addAnswer(A);
+            questions[Q].addAnswer(A, answers);
+            hotFeed.record(Q, HOT_WEIGHT_ANSWER, p.time);
+            stats.answers++;
+            return true;
+        };
+        while (postsFile.next(chunk))
+        {
+            auto rows = parseRowsParallel<DumpPostRow>(chunk, threads, [](const XmlRow &row, vector<DumpPostRow> &out)
+                                                       {
+                                                           int type = static_cast<int>(row.getInt("PostTypeId", 0));
+                                                           if (type != 1 && type != 2)
+                                                           {
+                                                               return;
+                                                           }
+                                                           DumpPostRow p{row.getInt("Id"), row.getInt("ParentId", DUMP_NO_ID), row.getInt("OwnerUserId", DUMP_NO_ID), type,
+                                                                         parseDumpTime(row.get("CreationDate")), string(), {}};
+                                                           appendXmlDecoded(row.get("Title"), p.text);
+                                                           if (!p.text.empty())
+                                                           {
+                                                               p.text.push_back('\n');
+                                                           }
+                                                           string body;
+                                                           appendXmlDecoded(row.get("Body"), body);
+                                                           p.text += stripHtml(body);
+                                                           string tagList;
+                                                           appendXmlDecoded(row.get("Tags"), tagList);
+                                                           p.tags = splitDumpTags(tagList);
+                                                           out.push_back(move(p)); });
+            for (auto &p : rows)
+            {
+                if (postIndex.count(p.id))
+                {
+                    stats.skipped++;
+                    continue;
+                }
+                if (p.type == 2)
+                {
+                    if (!importAnswer(p))
+                    {
+                        orphanAnswers.push_back(move(p));
+                    }
+                    continue;
+                }
+                UserHandle U = ownerOf(p.ownerId);
+                QuestionHandle Q = questions.emplace(p.id, questionTexts.add(p.text), U);
+                indexPost(p.id, PostRef{PostKind::Question, Q});
+                users[U].addQuestion(Q);
+                for (const string &tagName : p.tags)
+                {
+                    TagHandle T = bulkCreateTag(tagName);
+                    if (questions[Q].addTag(T))
+                    {
+                        tags[T].addUsage();
+                        searchIndex.addTag(Q, tagName);
+                    }
+                }
+                hotFeed.record(Q, HOT_WEIGHT_QUESTION, p.time);
+                stats.questions++;
+            }
+        }
+        // Answers listed before their question (rare in real dumps).
+        for (auto &p : orphanAnswers)
+        {
+            if (!importAnswer(p))
+            {
+                stats.skipped++;
+            }
+        }
+
+        ChunkedFileReader commentsFile(directory + "/Comments.xml");
+        while (commentsFile.next(chunk))
+        {
+            auto rows = parseRowsParallel<DumpCommentRow>(chunk, threads, [](const XmlRow &row, vector<DumpCommentRow> &out)
+                                                          {
+                                                              DumpCommentRow c{row.getInt("PostId"), row.getInt("UserId", DUMP_NO_ID), parseDumpTime(row.get("CreationDate")), string()};
+                                                              appendXmlDecoded(row.get("Text"), c.text);
+                                                              out.push_back(move(c)); });
+            for (auto &c : rows)
+            {
+                PostRef post = importedPost(c.postId);
+                if (post.handle == INVALID_HANDLE)
+                {
+                    stats.skipped++;
+                    continue;
+                }
+                // Dump comment ids overlap post ids, so comments get fresh ones.
+                CommentHandle C = createComment(ownerOf(c.userId), commentTexts.add(c.text), newPostId());
+                if (post.kind == PostKind::Question)
+                {
+                    questions[post.handle].addComment(C);
+                    hotFeed.record(post.handle, HOT_WEIGHT_COMMENT, c.time);
+                }
+                else
+                {
+                    answers[post.handle].addComment(C);
+                    hotFeed.record(answers[post.handle].getQuestion(), HOT_WEIGHT_COMMENT, c.time);
+                }
+                stats.comments++;
+            }
+        }
+
+        ChunkedFileReader votesFile(directory + "/Votes.xml");
+        while (votesFile.next(chunk))
+        {
+            auto rows = parseRowsParallel<DumpVoteRow>(chunk, threads, [](const XmlRow &row, vector<DumpVoteRow> &out)
+                                                       {
+                                                           int64_t type = row.getInt("VoteTypeId", 0);
+                                                           if (type == 2 || type == 3)
+                                                           {
+                                                               out.push_back({row.getInt("PostId"), type == 2});
+                                                           } });
+            for (auto &v : rows)
+            {
+                PostRef post = importedPost(v.postId);
+                if (post.handle == INVALID_HANDLE)
+                {
+                    stats.skipped++;
+                    continue;
+                }
+                if (post.kind == PostKind::Question)
+                {
+                    questions[post.handle].addAnonymousVotes(v.up, !v.up);
+                }
+                else
+                {
+                    answers[post.handle].addAnonymousVotes(v.up, !v.up);
+                }
+                stats.votes++;
+            }
+        }
+
+        rebuildAfterImport(firstUser, firstQuestion, firstAnswer, threads);
+        findCache.clear();
+        if (eventLog.isOpen())
+        {
+            checkpoint();
+        }
+        return stats;
+    }
+
+    // creating user
+    UserHandle createUser(string uname, string name)
+    {
+        if (uname != DELETED_USER_NAME && userByName.find(uname) == userByName.end())
+        {
+            if (eventLog.isOpen())
+            {
+                BinaryWriter record;
+                record.put(LogOp::CreateUser);
+                record.putString(uname);
+                record.putString(name);
+                logEvent(record);
+            }
+            return applyCreateUser(uname, name);
+        }
+        else
+        {
+            cout << "Username already exits, please change username" << endl;
+            return INVALID_HANDLE;
+        }
+    }
+
+    // Tags are interned, so every question using a tag shares one entry.
+    TagHandle createTag(const string &tagName)
+    {
+        auto it = tagByName.find(tagName);
+        if (it != tagByName.end())
+        {
+            return it->second;
+        }
+        if (eventLog.isOpen())
+        {
+            BinaryWriter record;
+            record.put(LogOp::CreateTag);
+            record.putString(tagName);
+            logEvent(record);
+        }
+        return applyCreateTag(tagName);
+    }
+
+    void addTag(QuestionHandle Q, const string &tagName)
+    {
+        if (eventLog.isOpen())
+        {
+            BinaryWriter record;
+            record.put(LogOp::AddTag);
+            record.put(Q);
+            record.putString(tagName);
+            logEvent(record);
+        }
+        applyAddTag(Q, tagName);
+    }
+
+    // Most used tags starting with prefix (case-insensitive).
+    vector<TagHandle> completeTags(const string &prefix, size_t n = 5) const
+    {
+        return tagCompletion.complete(prefix, n);
+    }
+
+    // Highest-reputation users whose username starts with prefix.
+    vector<UserHandle> completeUsernames(const string &prefix, size_t n = 5) const
+    {
+        return userCompletion.complete(prefix, n);
+    }
+
+    QuestionHandle addQuestion(UserHandle U, const string &text)
+    {
+        ScopedTimer timer(latencyOf(Operation::AddQuestion));
+        PostId id = newPostId();
+        double time = nowSeconds();
+        if (eventLog.isOpen())
+        {
+            BinaryWriter record;
+            record.put(LogOp::AddQuestion);
+            record.put(U);
+            record.put(id);
+            record.put(time);
+            record.putString(text);
+            logEvent(record);
+        }
+        return applyAddQuestion(U, text, id, time);
+    }
+
+    // Top-k questions for a keyword query, best first. Ranked by BM25 over
+    // the question text plus tag matches, vote score and answer count.
+    vector<ScoredDoc> searchQuestions(const string &query, size_t k = 10) const
+    {
+        ScopedTimer timer(latencyOf(Operation::SearchQuestions));
+        size_t scored = 0;
+        vector<ScoredDoc> results = searchIndex.search(query, k, &scored);
+        searchScanLength.record(scored);
+        return results;
+    }
+
+    // Results are cached per lowercased key; adding a question or a tag only
+    // drops the cached keys that the new text contains.
+    vector<QuestionHandle> findQuestion(string key) const
+    {
+        ScopedTimer timer(latencyOf(Operation::FindQuestion));
+        vector<QuestionHandle> response;
+        string lowerKey = toLower(key);
+        if (findCache.get(lowerKey, response))
+        {
+            return response;
+        }
+        uint64_t epoch = findCache.currentEpoch();
+
+        if (lowerKey.empty())
+        {
+            response.resize(questions.size());
+            iota(response.begin(), response.end(), 0);
+            return response;
+        }
+        CaseInsensitiveFinder finder(lowerKey);
+        findScanLength.record(questions.size());
+        unsigned threads = static_cast<unsigned>(min<size_t>(max(1u, thread::hardware_concurrency()),
+                                                             max<size_t>(1, questionTexts.bytes() / FIND_BYTES_PER_THREAD)));
+        // Author names and tag names are matched once, not once per question.
+        vector<char> userHit(users.size()), tagHit(tags.size());
+        parallelRanges(users.size(), threads, [&](size_t begin, size_t end)
+                       {
+                           for (size_t U = begin; U < end; ++U)
+                           {
+                               userHit[U] = finder.foundIn(users[U].getName());
+                           } });
+        for (TagHandle T = 0; T < tags.size(); ++T)
+        {
+            tagHit[T] = finder.foundIn(tags[T].getTag());
+        }
+        // One part per thread, concatenated in handle order.
+        vector<vector<QuestionHandle>> parts(threads);
+        onThreads(threads, [&](unsigned part)
+                  {
+                      QuestionHandle begin = questions.size() * part / threads;
+                      QuestionHandle end = questions.size() * (part + 1) / threads;
+                      scanQuestions(finder, begin, end, userHit, tagHit, parts[part]); });
+        for (auto &part : parts)
+        {
+            response.insert(response.end(), part.begin(), part.end());
+        }
+        findCache.put(lowerKey, response, epoch);
+        return response;
+    }
+
+    // Pre-submit check: stored questions that look like near-duplicates of
+    // text, most similar first.
+    vector<DuplicateMatch> findDuplicates(const string &text, size_t k = 5) const
+    {
+        ScopedTimer timer(latencyOf(Operation::FindDuplicates));
+        return duplicates.similarTo(text, DUPLICATE_MIN_SIMILARITY, k);
+    }
+
+    vector<DuplicateMatch> findDuplicatesOf(QuestionHandle Q, size_t k = 5) const
+    {
+        return duplicates.similarTo(Q, DUPLICATE_MIN_SIMILARITY, k);
+    }
+
+    QueryCacheStats getFindCacheStats() const
+    {
+        return findCache.stats();
+    }
+
+    // U's reputation changes, oldest first. Walks the whole ledger, so it is
+    // meant for audits rather than page views.
+    vector<ReputationEntry> getReputationHistory(UserHandle U) const
+    {
+        return reputationLedger.historyOf(U);
+    }
+
+    // Every user's reputation under other weights, e.g. to try new
+    // REPUTATION_FOR_* values; the live totals are left alone.
+    vector<int> previewReputation(const ReputationWeights &weights, unsigned threads = max(1u, thread::hardware_concurrency())) const
+    {
+        return reputationLedger.totals(weights, users.size(), threads);
+    }
+
+    // Re-derives every user's reputation from the ledger and returns how
+    // many stored totals disagreed with it.
+    size_t recomputeReputation(unsigned threads = max(1u, thread::hardware_concurrency()))
+    {
+        vector<int> reputation = reputationLedger.totals(users.size(), threads);
+        size_t corrected = 0;
+        for (UserHandle U = 0; U < users.size(); ++U)
+        {
+            if (users[U].getReputation() != reputation[U])
+            {
+                users[U].setReputation(reputation[U]);
+                refreshUserCompletion(U);
+                corrected++;
+            }
+        }
+        return corrected;
+    }
+
+    // The instrumentation as a Prometheus text snapshot: latency per call,
+    // scan lengths, cache activity, entity counts and memory. The memory
+    // figures walk every user and post, so this is for scrapes, not for
+    // every request.
+    string exportMetrics() const
+    {
+        MetricsText m;
+        m.family("stackoverflow_operation_duration_seconds", "histogram", "Latency of public StackOverflow calls.");
+        for (size_t op = 0; op < static_cast<size_t>(Operation::Count); ++op)
+        {
+            m.histogram("stackoverflow_operation_duration_seconds", "operation=\"" + string(OPERATION_NAMES[op]) + "\"",
+                        latency[op], 1e-9, 8, 34);
+        }
+        m.family("stackoverflow_find_questions_examined", "histogram", "Questions scanned by a findQuestion that missed the cache.");
+        m.histogram("stackoverflow_find_questions_examined", "", findScanLength, 1, 0, 26);
+        m.family("stackoverflow_search_documents_scored", "histogram", "Documents scored by one searchQuestions.");
+        m.histogram("stackoverflow_search_documents_scored", "", searchScanLength, 1, 0, 26);
+        m.family("stackoverflow_vote_scan_length", "histogram", "Existing votes examined by one vote call.");
+        m.histogram("stackoverflow_vote_scan_length", "", voteScanLength, 1, 0, 20);
+
+        QueryCacheStats cache = findCache.stats();
+        m.family("stackoverflow_find_cache_events_total", "counter", "findQuestion result cache activity.");
+        m.sample("stackoverflow_find_cache_events_total", "event=\"hit\"", cache.hits);
+        m.sample("stackoverflow_find_cache_events_total", "event=\"miss\"", cache.misses);
+        m.sample("stackoverflow_find_cache_events_total", "event=\"eviction\"", cache.evictions);
+        m.sample("stackoverflow_find_cache_events_total", "event=\"invalidation\"", cache.invalidations);
+
+        const pair<string, TextPoolStats> tiers[] = {
+            {"pool=\"question\"", questionTexts.stats()},
+            {"pool=\"answer\"", answerTexts.stats()},
+            {"pool=\"comment\"", commentTexts.stats()}};
+        m.family("stackoverflow_cold_text_bytes", "gauge", "Compressed post text moved out of memory, per text pool.");
+        for (const auto &[label, tier] : tiers)
+        {
+            m.sample("stackoverflow_cold_text_bytes", label, tier.coldBytes);
+        }
+        m.family("stackoverflow_text_block_cache_events_total", "counter", "Cold text blocks served from or read into the block cache.");
+        for (const auto &[label, tier] : tiers)
+        {
+            m.sample("stackoverflow_text_block_cache_events_total", label + ",event=\"hit\"", tier.cacheHits);
+            m.sample("stackoverflow_text_block_cache_events_total", label + ",event=\"miss\"", tier.cacheMisses);
+        }
+
+        m.family("stackoverflow_entities", "gauge", "Live objects per entity type.");
+        m.sample("stackoverflow_entities", "entity=\"users\"", users.liveCount());
+        m.sample("stackoverflow_entities", "entity=\"tags\"", tags.liveCount());
+        m.sample("stackoverflow_entities", "entity=\"questions\"", questions.liveCount());
+        m.sample("stackoverflow_entities", "entity=\"answers\"", answers.liveCount());
+        m.sample("stackoverflow_entities", "entity=\"comments\"", comments.liveCount());
+        m.sample("stackoverflow_entities", "entity=\"votes\"", votes.liveCount());
+        m.sample("stackoverflow_entities", "entity=\"reputation_entries\"", reputationLedger.size());
+
+        // Arena slots plus what each object owns on the heap; texts and
+        // indexes are listed on their own.
+        auto arenaBytes = [](const auto &arena)
+        {
+            size_t total = arena.slabBytes();
+            for (Handle h = 0; h < arena.size(); ++h)
+            {
+                total += arena[h].heapBytes();
+            }
+            return total;
+        };
+        m.family("stackoverflow_memory_bytes", "gauge", "Approximate memory held per entity type and index.");
+        m.sample("stackoverflow_memory_bytes", "part=\"users\"", arenaBytes(users));
+        m.sample("stackoverflow_memory_bytes", "part=\"tags\"", arenaBytes(tags));
+        m.sample("stackoverflow_memory_bytes", "part=\"questions\"", arenaBytes(questions));
+        m.sample("stackoverflow_memory_bytes", "part=\"answers\"", arenaBytes(answers));
+        m.sample("stackoverflow_memory_bytes", "part=\"comments\"", comments.slabBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"votes\"", votes.slabBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"question_texts\"", questionTexts.capacityBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"answer_texts\"", answerTexts.capacityBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"comment_texts\"", commentTexts.capacityBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"search_index\"", searchIndex.memoryBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"duplicate_index\"", duplicates.memoryBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"reputation_ledger\"", reputationLedger.memoryBytes());
+        m.sample("stackoverflow_memory_bytes", "part=\"find_cache\"", cache.bytes);
+        return m.text();
+    }
+
+    AnswerHandle answerQuestion(UserHandle U, QuestionHandle Q, const string &answerText)
+    {
+        ScopedTimer timer(latencyOf(Operation::AnswerQuestion));
+        PostId ansId = newPostId();
+        double time = nowSeconds();
+        if (eventLog.isOpen())
+        {
+            BinaryWriter record;
+            record.put(LogOp::AnswerQuestion);
+            record.put(U);
+            record.put(Q);
+            record.put(ansId);
+            record.put(time);
+            record.putString(answerText);
+            logEvent(record);
+        }
+        return applyAnswerQuestion(U, Q, answerText, ansId, time);
+    };
+
+    void addVoteOnQuestion(UserHandle U, QuestionHandle Q, voteType V)
+    {
+        ScopedTimer timer(latencyOf(Operation::Vote));
+        double time = nowSeconds();
+        logVote(LogOp::VoteOnQuestion, U, Q, V, time);
+        applyVoteOnQuestion(U, Q, V, time);
+    }
+
+    void addVoteOnAnswer(UserHandle U, AnswerHandle A, voteType V)
+    {
+        ScopedTimer timer(latencyOf(Operation::Vote));
+        double time = nowSeconds();
+        logVote(LogOp::VoteOnAnswer, U, A, V, time);
+        applyVoteOnAnswer(U, A, V, time);
+    }
+
+    // Applies a batch drained by WritePipeline; results go to each command's
+    // `result`. Posts, tags and comments run in order through the calls
+    // above. Votes are coalesced per (voter, post): every vote call maps the
+    // voter's state (none, up, down) to a new one, so a run of toggles
+    // composes into one mapping and costs at most one real vote. Reputation
+    // changes are then summed per author, and search boosts and the hot feed
+    // are refreshed once per touched question.
+    void applyBatch(vector<Command> &batch)
+    {
+        ScopedTimer timer(latencyOf(Operation::ApplyBatch));
+        struct PendingVote
+        {
+            bool onAnswer;
+            Handle post;
+            UserHandle user;
+            array<uint8_t, 3> next{0, 1, 2}; // state index -> state after the run
+        };
+        auto stateOf = [](voteType V) -> uint8_t
+        {
+            return V == voteType::Upvote ? 1 : 2;
+        };
+
+        inBatch = true;
+        vector<PendingVote> pending;
+        unordered_map<uint64_t, size_t> slot[2];
+        for (Command &c : batch)
+        {
+            switch (c.kind)
+            {
+            case CommandKind::AddQuestion:
+                c.result = addQuestion(c.user, c.text);
+                break;
+            case CommandKind::AddTag:
+                addTag(c.target, c.text);
+                break;
+            case CommandKind::AnswerQuestion:
+                c.result = answerQuestion(c.user, c.target, c.text);
+                break;
+            case CommandKind::CommentOnQuestion:
+                addCommentOnQuestion(c.user, c.target, c.text);
+                break;
+            case CommandKind::CommentOnAnswer:
+                addCommentOnAnswer(c.user, c.target, c.answer, c.text);
+                break;
+            case CommandKind::VoteOnQuestion:
+            case CommandKind::VoteOnAnswer:
+            {
+                bool onAnswer = c.kind == CommandKind::VoteOnAnswer;
+                uint64_t key = static_cast<uint64_t>(c.target) << 32 | c.user;
+                auto it = slot[onAnswer].emplace(key, pending.size()).first;
+                if (it->second == pending.size())
+                {
+                    pending.push_back({onAnswer, c.target, c.user});
+                }
+                uint8_t cast = stateOf(c.vote);
+                for (uint8_t &state : pending[it->second].next)
+                {
+                    state = state == cast ? 0 : cast;
+                }
+                break;
+            }
+            }
+        }
+
+        unordered_map<UserHandle, int> reputationDelta;
+        unordered_map<QuestionHandle, int> scoreChange;
+        double time = nowSeconds();
+        for (const PendingVote &v : pending)
+        {
+            const Vote *current = v.onAnswer ? answers[v.post].findVote(v.user, votes) : questions[v.post].findVote(v.user, votes);
+            uint8_t from = current == nullptr ? 0 : stateOf(current->getVoteType());
+            uint8_t to = v.next[from];
+            if (from == to)
+            {
+                continue;
+            }
+            // One call reaches any other state: withdraw by repeating the
+            // current vote, otherwise cast the target one.
+            voteType V = (to == 0 ? from : to) == 1 ? voteType::Upvote : voteType::Downvote;
+            if (v.onAnswer)
+            {
+                Answer &answer = answers[v.post];
+                logVote(LogOp::VoteOnAnswer, v.user, v.post, V, time);
+                int before = answer.getScore();
+                VoteChange change = answer.addVote(v.user, V, votes);
+                voteScanLength.record(change.examined);
+                reputationDelta[answer.getUser()] += recordVote(answer.getUser(), v.post, true, change);
+                users[v.user].addVoteCast({answer.getAnswerId(), V, change.action()});
+                questions[answer.getQuestion()].reorderAnswer(v.post, answers);
+                scoreChange[answer.getQuestion()] += answer.getScore() - before;
+            }
+            else
+            {
+                Question &question = questions[v.post];
+                logVote(LogOp::VoteOnQuestion, v.user, v.post, V, time);
+                int before = question.getUpvote() - question.getDownVote();
+                VoteChange change = question.addVote(v.user, V, votes);
+                voteScanLength.record(change.examined);
+                reputationDelta[question.getUser()] += recordVote(question.getUser(), v.post, false, change);
+                users[v.user].addVoteCast({question.getQuestionId(), V, change.action()});
+                scoreChange[v.post] += question.getUpvote() - question.getDownVote() - before;
+            }
+        }
+        for (auto &[U, delta] : reputationDelta)
+        {
+            users[U].addReputation(delta);
+            refreshUserCompletion(U);
+        }
+        for (auto &[Q, change] : scoreChange)
+        {
+            refreshSearchBoost(Q);
+            hotFeed.record(Q, HOT_WEIGHT_VOTE * change, time);
+        }
+        inBatch = false;
+        if (eventLog.isOpen() && checkpointEvery != 0 && eventsSinceCheckpoint >= checkpointEvery)
+        {
+            checkpoint();
+        }
+    }
+
+    void addCommentOnQuestion(UserHandle U, QuestionHandle Q, string commentText)
+    {
+        ScopedTimer timer(latencyOf(Operation::Comment));
+        string trimmed = commentText;
+        trimmed.erase(remove_if(trimmed.begin(), trimmed.end(), ::isspace), trimmed.end());
+
+        if (trimmed.empty())
         {
             cout << "Comment cannot be empty or only spaces." << endl;
             return;
         }
-        Q->addComment(U, commentText);
+        PostId cId = newPostId();
+        double time = nowSeconds();
+        if (eventLog.isOpen())
+        {
+            BinaryWriter record;
+            record.put(LogOp::CommentOnQuestion);
+            record.put(U);
+            record.put(Q);
+            record.put(cId);
+            record.put(time);
+            record.putString(commentText);
+            logEvent(record);
+        }
+        applyCommentOnQuestion(U, Q, commentText, cId, time);
     }
 
-    void addCommentOnAnswer(shared_ptr<User> U, shared_ptr<Question> Q, shared_ptr<Answer> A, const string &commenttext)
+    void addCommentOnAnswer(UserHandle U, QuestionHandle Q, AnswerHandle A, const string &commenttext)
     {
+        ScopedTimer timer(latencyOf(Operation::Comment));
         string trimmed = commenttext;
         trimmed.erase(remove_if(trimmed.begin(), trimmed.end(), ::isspace), trimmed.end());
 
@@ -474,6 +2474,268 @@ public:
             cout << "Comment cannot be empty or only spaces." << endl;
             return;
         }
-        Q->addCommentOnAnswer(U, A, commenttext);
+        if (answers[A].getQuestion() != Q)
+        {
+            return;
+        }
+        PostId cId = newPostId();
+        double time = nowSeconds();
+        if (eventLog.isOpen())
+        {
+            BinaryWriter record;
+            record.put(LogOp::CommentOnAnswer);
+            record.put(U);
+            record.put(A);
+            record.put(cId);
+            record.put(time);
+            record.putString(commenttext);
+            logEvent(record);
+        }
+        applyCommentOnAnswer(U, A, commenttext, cId, time);
+    }
+
+    // Front page "hot questions": recent activity, decayed over time.
+    vector<QuestionHandle> getHotQuestions(size_t k = 20) const
+    {
+        return hotFeed.hottest(k);
+    }
+
+    // Exact username lookup; INVALID_HANDLE if there is no such user. The
+    // user's posts and votes are then listed by getUser(U).getQuestions()
+    // and friends, in time proportional to that user's activity.
+    UserHandle findUser(const string &uname) const
+    {
+        auto it = userByName.find(uname);
+        return it != userByName.end() ? it->second : INVALID_HANDLE;
+    }
+
+    // Resolves a public post id; the handle is INVALID_HANDLE if unknown.
+    PostRef findPost(PostId id) const
+    {
+        auto it = postIndex.find(id);
+        return it == postIndex.end() ? PostRef{} : it->second;
+    }
+
+    QuestionHandle findQuestionById(PostId id) const
+    {
+        PostRef ref = findPost(id);
+        return ref.kind == PostKind::Question ? ref.handle : INVALID_HANDLE;
+    }
+
+    AnswerHandle findAnswerById(PostId id) const
+    {
+        PostRef ref = findPost(id);
+        return ref.kind == PostKind::Answer ? ref.handle : INVALID_HANDLE;
+    }
+
+    CommentHandle findCommentById(PostId id) const
+    {
+        PostRef ref = findPost(id);
+        return ref.kind == PostKind::Comment ? ref.handle : INVALID_HANDLE;
+    }
+
+    const User &getUser(UserHandle U) const
+    {
+        return users[U];
+    }
+
+    const Tags &getTag(TagHandle T) const
+    {
+        return tags[T];
+    }
+
+    const Question &getQuestion(QuestionHandle Q) const
+    {
+        return questions[Q];
+    }
+
+    const Answer &getAnswer(AnswerHandle A) const
+    {
+        return answers[A];
+    }
+
+    const Comments &getComment(CommentHandle C) const
+    {
+        return comments[C];
+    }
+
+    PinnedText getQuestionText(QuestionHandle Q) const
+    {
+        return questionTexts.get(questions[Q].getQuestionText());
+    }
+
+    PinnedText getAnswerText(AnswerHandle A) const
+    {
+        return answerTexts.get(answers[A].getAnswerText());
+    }
+
+    PinnedText getCommentText(CommentHandle C) const
+    {
+        return commentTexts.get(comments[C].getCommentText());
+    }
+};
+
+// Optional write path for bursty traffic. Any thread submits mutations
+// into a lock-free queue and returns at once; one writer thread drains the
+// queue in batches and applies each batch with StackOverflow::applyBatch,
+// where repeated vote toggles collapse and reputation changes are grouped
+// per user. Readers go through read(), which holds the state lock shared,
+// so they only ever see the state between two whole batches (the published
+// version counts those batches).
+class WritePipeline
+{
+private:
+    static constexpr size_t MAX_BATCH = 4096;
+    static constexpr chrono::milliseconds IDLE_POLL{1};
+
+    StackOverflow &so;
+    shared_mutex stateLock;
+    MpscQueue<Command> queue;
+    atomic<uint64_t> submitted{0};
+    atomic<uint64_t> published{0};
+    atomic<bool> writerIdle{false};
+    atomic<bool> stopping{false};
+    mutex doorbellMtx;
+    condition_variable doorbell;
+    mutex appliedMtx;
+    condition_variable appliedCv;
+    uint64_t applied = 0;
+    thread writer;
+
+    void writeLoop()
+    {
+        vector<Command> batch;
+        while (true)
+        {
+            batch.clear();
+            Command c;
+            while (batch.size() < MAX_BATCH && queue.pop(c))
+            {
+                batch.push_back(move(c));
+            }
+            if (batch.empty())
+            {
+                if (stopping.load())
+                {
+                    break;
+                }
+                unique_lock<mutex> lock(doorbellMtx);
+                writerIdle.store(true);
+                doorbell.wait_for(lock, IDLE_POLL, [this]
+                                  { return stopping.load() || !queue.empty(); });
+                writerIdle.store(false);
+                continue;
+            }
+            {
+                unique_lock<shared_mutex> lock(stateLock);
+                so.applyBatch(batch);
+                published.fetch_add(1);
+            }
+            // Callbacks run before the batch counts as applied, so flush()
+            // returns only after those of the commands it waited for.
+            for (Command &done : batch)
+            {
+                if (done.done)
+                {
+                    done.done(done.result);
+                }
+            }
+            {
+                lock_guard<mutex> lock(appliedMtx);
+                applied += batch.size();
+            }
+            appliedCv.notify_all();
+        }
+    }
+
+public:
+    explicit WritePipeline(StackOverflow &so) : so(so)
+    {
+        writer = thread(&WritePipeline::writeLoop, this);
+    }
+
+    WritePipeline(const WritePipeline &) = delete;
+    WritePipeline &operator=(const WritePipeline &) = delete;
+
+    // Applies everything still queued before returning.
+    ~WritePipeline()
+    {
+        stopping.store(true);
+        {
+            lock_guard<mutex> lock(doorbellMtx);
+            doorbell.notify_one();
+        }
+        writer.join();
+    }
+
+    // Queues a command; returns how many commands have been submitted so far.
+    uint64_t submit(Command command)
+    {
+        uint64_t ticket = submitted.fetch_add(1) + 1;
+        queue.push(move(command));
+        if (writerIdle.load())
+        {
+            lock_guard<mutex> lock(doorbellMtx);
+            doorbell.notify_one();
+        }
+        return ticket;
+    }
+
+    uint64_t addQuestion(UserHandle U, string text, function<void(Handle)> done = nullptr)
+    {
+        return submit({CommandKind::AddQuestion, U, INVALID_HANDLE, INVALID_HANDLE, voteType::Upvote, move(text), move(done)});
+    }
+
+    uint64_t addTag(QuestionHandle Q, string tagName)
+    {
+        return submit({CommandKind::AddTag, INVALID_HANDLE, Q, INVALID_HANDLE, voteType::Upvote, move(tagName)});
+    }
+
+    uint64_t answerQuestion(UserHandle U, QuestionHandle Q, string text, function<void(Handle)> done = nullptr)
+    {
+        return submit({CommandKind::AnswerQuestion, U, Q, INVALID_HANDLE, voteType::Upvote, move(text), move(done)});
+    }
+
+    uint64_t addVoteOnQuestion(UserHandle U, QuestionHandle Q, voteType V)
+    {
+        return submit({CommandKind::VoteOnQuestion, U, Q, INVALID_HANDLE, V});
+    }
+
+    uint64_t addVoteOnAnswer(UserHandle U, AnswerHandle A, voteType V)
+    {
+        return submit({CommandKind::VoteOnAnswer, U, A, INVALID_HANDLE, V});
     }
-};
\ No newline at end of file
+
+    uint64_t addCommentOnQuestion(UserHandle U, QuestionHandle Q, string text)
+    {
+        return submit({CommandKind::CommentOnQuestion, U, Q, INVALID_HANDLE, voteType::Upvote, move(text)});
+    }
+
+    uint64_t addCommentOnAnswer(UserHandle U, QuestionHandle Q, AnswerHandle A, string text)
+    {
+        return submit({CommandKind::CommentOnAnswer, U, Q, A, voteType::Upvote, move(text)});
+    }
+
+    // Blocks until every command submitted before the call is applied and
+    // its done callback has run.
+    void flush()
+    {
+        uint64_t target = submitted.load();
+        unique_lock<mutex> lock(appliedMtx);
+        appliedCv.wait(lock, [&]
+                       { return applied >= target; });
+    }
+
+    // Runs fn(const StackOverflow &) against a whole-batch state.
+    template <typename Fn>
+    auto read(Fn &&fn)
+    {
+        shared_lock<shared_mutex> lock(stateLock);
+        return fn(static_cast<const StackOverflow &>(so));
+    }
+
+    uint64_t publishedVersion() const
+    {
+        return published.load();
+    }
+};
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Building blocks for on-disk persistence: a binary encoder/decoder, a
+// read-only memory mapping, an append-only event log with group commit and
+// atomic snapshot files. Linux/POSIX only.
+
+// CRC-32 (IEEE). Pass the previous result as crc to continue a checksum
+// over several pieces. Eight bytes are folded per step through eight tables
+// (slicing-by-8); words are read little-endian, like the rest of the format.
+inline std::uint32_t crc32(const char *data, std::size_t size, std::uint32_t crc = 0)
+{
+    static const std::array<std::array<std::uint32_t, 256>, 8> table = []
+    {
+        std::array<std::array<std::uint32_t, 256>, 8> t{};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[0][i] = c;
+        }
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            for (int k = 1; k < 8; ++k)
+            {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+            }
+        }
+        return t;
+    }();
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    crc = ~crc;
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        std::uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+    }
+    for (; size > 0; --size, ++p)
+    {
+        crc = table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Appends fixed-width values (native byte order) and length-prefixed strings to a
+// byte buffer. When given a file descriptor it spills the buffer to the file
+// every SPILL_BYTES, so large snapshots are streamed rather than held whole.
+class BinaryWriter
+{
+private:
+    static constexpr std::size_t SPILL_BYTES = 1 << 20;
+
+    std::string buffer;
+    int fd = -1;
+    bool failed = false;
+    std::uint32_t flushedCrc = 0; // of everything already written to fd
+
+    void spillIfFull()
+    {
+        if (fd >= 0 && buffer.size() >= SPILL_BYTES)
+        {
+            flush();
+        }
+    }
+
+public:
+    BinaryWriter() = default;
+    explicit BinaryWriter(int fd) : fd(fd) {}
+
+    template <typename T>
+    void put(T value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "put() needs a plain value");
+        buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        spillIfFull();
+    }
+
+    void putString(std::string_view s)
+    {
+        put<std::uint32_t>(static_cast<std::uint32_t>(s.size()));
+        putBytes(s.data(), s.size());
+    }
+
+    void putBytes(const void *data, std::size_t size)
+    {
+        buffer.append(static_cast<const char *>(data), size);
+        spillIfFull();
+    }
+
+    // Writes the buffered bytes to the file, if there is one.
+    bool flush()
+    {
+        if (fd < 0)
+        {
+            return true;
+        }
+        flushedCrc = crc32(buffer.data(), buffer.size(), flushedCrc);
+        const char *p = buffer.data();
+        std::size_t left = buffer.size();
+        while (left > 0 && !failed)
+        {
+            ssize_t n = ::write(fd, p, left);
+            if (n < 0)
+            {
+                failed = true;
+                break;
+            }
+            p += n;
+            left -= static_cast<std::size_t>(n);
+        }
+        buffer.clear();
+        return !failed;
+    }
+
+    const std::string &bytes() const
+    {
+        return buffer;
+    }
+
+    // CRC-32 of every byte put so far.
+    std::uint32_t checksum() const
+    {
+        return crc32(buffer.data(), buffer.size(), flushedCrc);
+    }
+
+    void clear()
+    {
+        buffer.clear();
+        flushedCrc = 0;
+    }
+};
+
+// Reads back what BinaryWriter produced. Running past the end sets failed()
+// and yields zeros / empty strings instead of reading out of bounds.
+class BinaryReader
+{
+private:
+    const char *cur;
+    const char *end;
+    bool bad = false;
+
+public:
+    BinaryReader(const char *data, std::size_t size) : cur(data), end(data + size) {}
+
+    template <typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "get() needs a plain value");
+        T value{};
+        if (static_cast<std::size_t>(end - cur) < sizeof(T))
+        {
+            bad = true;
+            cur = end;
+            return value;
+        }
+        std::memcpy(&value, cur, sizeof(T));
+        cur += sizeof(T);
+        return value;
+    }
+
+    // The view points into the underlying buffer (or mapping).
+    std::string_view getString()
+    {
+        std::uint32_t size = get<std::uint32_t>();
+        const char *first = static_cast<const char *>(getBytes(size));
+        return std::string_view(first, bad ? 0 : size);
+    }
+
+    const void *getBytes(std::size_t size)
+    {
+        if (static_cast<std::size_t>(end - cur) < size)
+        {
+            bad = true;
+            cur = end;
+            return cur;
+        }
+        const char *p = cur;
+        cur += size;
+        return p;
+    }
+
+    bool atEnd() const
+    {
+        return cur == end;
+    }
+
+    bool failed() const
+    {
+        return bad;
+    }
+};
+
+// Read-only mmap of a whole file.
+class MappedFile
+{
+private:
+    void *addr = nullptr;
+    std::size_t length = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length > 0)
+        {
+            addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                addr = nullptr;
+                length = 0;
+                ::close(fd);
+                return false;
+            }
+            ::madvise(addr, length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    void close()
+    {
+        if (addr != nullptr)
+        {
+            ::munmap(addr, length);
+        }
+        addr = nullptr;
+        length = 0;
+    }
+
+    const char *data() const
+    {
+        return static_cast<const char *>(addr);
+    }
+
+    std::size_t size() const
+    {
+        return length;
+    }
+};
+
+// Append-only log of opaque records, each framed as [length][crc32][bytes].
+//
+// append() only copies the record into the pending batch and returns its
+// sequence number; a background thread writes and fdatasync()s whole
+// batches (group commit), waiting up to COMMIT_WINDOW for more records to
+// join before each sync. waitDurable() blocks until a given record is on
+// disk. On replay a torn or corrupt tail record ends the log.
+class EventLog
+{
+private:
+    static constexpr std::chrono::milliseconds COMMIT_WINDOW{2};
+    static constexpr std::size_t MAX_BATCH_BYTES = 4 << 20;
+
+    int fd = -1;
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::condition_variable durable;
+    std::string pending;
+    std::uint64_t appendedSeq = 0;
+    std::uint64_t durableSeq = 0;
+    bool stopping = false;
+    bool ioError = false;
+    std::thread flusher;
+
+    void flushLoop()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            wake.wait(lock, [this]
+                      { return stopping || !pending.empty(); });
+            if (pending.empty())
+            {
+                break; // stopping with nothing left to write
+            }
+            wake.wait_for(lock, COMMIT_WINDOW, [this]
+                          { return stopping || pending.size() >= MAX_BATCH_BYTES; });
+            std::string batch;
+            batch.swap(pending);
+            std::uint64_t batchSeq = appendedSeq;
+            lock.unlock();
+
+            bool ok = true;
+            const char *p = batch.data();
+            std::size_t left = batch.size();
+            while (left > 0)
+            {
+                ssize_t n = ::write(fd, p, left);
+                if (n < 0)
+                {
+                    ok = false;
+                    break;
+                }
+                p += n;
+                left -= static_cast<std::size_t>(n);
+            }
+            ok = ok && ::fdatasync(fd) == 0;
+
+            lock.lock();
+            if (!ok && !ioError)
+            {
+                ioError = true;
+                std::cout << "Event log write failed, further events are not durable" << std::endl;
+            }
+            durableSeq = batchSeq;
+            durable.notify_all();
+        }
+    }
+
+public:
+    EventLog() = default;
+    EventLog(const EventLog &) = delete;
+    EventLog &operator=(const EventLog &) = delete;
+
+    ~EventLog()
+    {
+        close();
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        stopping = false;
+        ioError = false;
+        appendedSeq = durableSeq = 0;
+        flusher = std::thread(&EventLog::flushLoop, this);
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return fd >= 0;
+    }
+
+    // Flushes everything still pending and closes the file.
+    void close()
+    {
+        if (fd < 0)
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        flusher.join();
+        ::close(fd);
+        fd = -1;
+    }
+
+    std::uint64_t append(std::string_view record)
+    {
+        std::uint32_t size = static_cast<std::uint32_t>(record.size());
+        std::uint32_t crc = crc32(record.data(), record.size());
+        std::lock_guard<std::mutex> lock(mtx);
+        bool wasEmpty = pending.empty();
+        pending.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        pending.append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        pending.append(record.data(), record.size());
+        // The flusher only needs waking to start a batch or cut one short.
+        if (wasEmpty || pending.size() >= MAX_BATCH_BYTES)
+        {
+            wake.notify_one();
+        }
+        return ++appendedSeq;
+    }
+
+    void waitDurable(std::uint64_t seq)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        durable.wait(lock, [&]
+                     { return durableSeq >= seq; });
+    }
+
+    // Blocks until every record appended so far is on disk.
+    void sync()
+    {
+        std::uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            seq = appendedSeq;
+        }
+        waitDurable(seq);
+    }
+
+    // Calls fn(BinaryReader &) for each intact record of the log at path and
+    // returns how many there were. A missing file is an empty log. If given,
+    // validBytes receives the length of the intact prefix, which the caller
+    // should truncate to before appending again.
+    template <typename Fn>
+    static std::uint64_t replay(const std::string &path, Fn &&fn, std::size_t *validBytes = nullptr)
+    {
+        if (validBytes != nullptr)
+        {
+            *validBytes = 0;
+        }
+        MappedFile file;
+        if (!file.open(path))
+        {
+            return 0;
+        }
+        BinaryReader frames(file.data(), file.size());
+        std::uint64_t count = 0;
+        while (!frames.atEnd())
+        {
+            std::uint32_t size = frames.get<std::uint32_t>();
+            std::uint32_t crc = frames.get<std::uint32_t>();
+            const char *body = static_cast<const char *>(frames.getBytes(size));
+            if (frames.failed() || crc32(body, size) != crc)
+            {
+                break;
+            }
+            BinaryReader record(body, size);
+            fn(record);
+            count++;
+            if (validBytes != nullptr)
+            {
+                *validBytes = static_cast<std::size_t>(body + size - file.data());
+            }
+        }
+        return count;
+    }
+};
+
+// Writes a file under a temporary name and renames it into place once it is
+// fully on disk, so readers only ever see a complete snapshot.
+class SnapshotFile
+{
+private:
+    std::string path;
+    std::string tempPath;
+    int fd = -1;
+
+public:
+    SnapshotFile(const SnapshotFile &) = delete;
+    SnapshotFile &operator=(const SnapshotFile &) = delete;
+
+    explicit SnapshotFile(const std::string &path) : path(path), tempPath(path + ".tmp")
+    {
+        fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    ~SnapshotFile()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            ::unlink(tempPath.c_str());
+        }
+    }
+
+    int descriptor() const
+    {
+        return fd;
+    }
+
+    bool commit()
+    {
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        fd = -1;
+        ok = ok && ::rename(tempPath.c_str(), path.c_str()) == 0;
+        if (!ok)
+        {
+            ::unlink(tempPath.c_str());
+            return false;
+        }
+        // Make the rename itself durable.
+        std::size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0)
+        {
+            ::fsync(dirFd);
+            ::close(dirFd);
+        }
+        return true;
+    }
+};
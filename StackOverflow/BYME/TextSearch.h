@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// ASCII case-insensitive substring search that needs no lowercased copy of
+// the text. Same matching rules as lowercasing both sides with ::tolower in
+// the "C" locale.
+//
+// The vector paths test a whole block of candidate start positions at once:
+// a position survives only if its byte equals the needle's first character
+// and the byte needle.size() - 1 further on equals the last character (each
+// in either case). Survivors are rare in real text and are confirmed with a
+// scalar compare. AVX2 is picked at run time; SSE2 is the x86-64 baseline,
+// and other targets use the scalar loop.
+class CaseInsensitiveFinder
+{
+private:
+    std::string needle; // lowercased
+    char firstLower = 0, firstUpper = 0, lastLower = 0, lastUpper = 0;
+
+    static char fold(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+    }
+
+    static char upper(char c)
+    {
+        return c >= 'a' && c <= 'z' ? static_cast<char>(c - ('a' - 'A')) : c;
+    }
+
+    bool matchesAt(const char *p) const
+    {
+        for (std::size_t i = 0; i < needle.size(); ++i)
+        {
+            if (fold(p[i]) != needle[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::size_t findScalar(std::string_view hay, std::size_t from) const
+    {
+        for (std::size_t i = from; i + needle.size() <= hay.size(); ++i)
+        {
+            if (matchesAt(hay.data() + i))
+            {
+                return i;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+#if defined(__SSE2__)
+    // Candidate positions [i, i + 16) of hay; returns the first match or
+    // npos, and leaves i at the first position not yet examined.
+    std::size_t findSse2(std::string_view hay, std::size_t &i) const
+    {
+        const __m128i f0 = _mm_set1_epi8(firstLower), f1 = _mm_set1_epi8(firstUpper);
+        const __m128i l0 = _mm_set1_epi8(lastLower), l1 = _mm_set1_epi8(lastUpper);
+        const std::size_t n = needle.size();
+        for (; i + n - 1 + 16 <= hay.size(); i += 16)
+        {
+            __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hay.data() + i));
+            __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hay.data() + i + n - 1));
+            __m128i eq = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(head, f0), _mm_cmpeq_epi8(head, f1)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(tail, l0), _mm_cmpeq_epi8(tail, l1)));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq));
+            while (mask != 0)
+            {
+                std::size_t pos = i + static_cast<std::size_t>(__builtin_ctz(mask));
+                if (matchesAt(hay.data() + pos))
+                {
+                    return pos;
+                }
+                mask &= mask - 1;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    __attribute__((target("avx2"))) std::size_t findAvx2(std::string_view hay, std::size_t &i) const
+    {
+        const __m256i f0 = _mm256_set1_epi8(firstLower), f1 = _mm256_set1_epi8(firstUpper);
+        const __m256i l0 = _mm256_set1_epi8(lastLower), l1 = _mm256_set1_epi8(lastUpper);
+        const std::size_t n = needle.size();
+        for (; i + n - 1 + 32 <= hay.size(); i += 32)
+        {
+            __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hay.data() + i));
+            __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hay.data() + i + n - 1));
+            __m256i eq = _mm256_and_si256(_mm256_or_si256(_mm256_cmpeq_epi8(head, f0), _mm256_cmpeq_epi8(head, f1)),
+                                          _mm256_or_si256(_mm256_cmpeq_epi8(tail, l0), _mm256_cmpeq_epi8(tail, l1)));
+            std::uint32_t mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(eq));
+            while (mask != 0)
+            {
+                std::size_t pos = i + static_cast<std::size_t>(__builtin_ctz(mask));
+                if (matchesAt(hay.data() + pos))
+                {
+                    return pos;
+                }
+                mask &= mask - 1;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    static bool hasAvx2()
+    {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+#endif
+
+public:
+    explicit CaseInsensitiveFinder(std::string_view pattern)
+    {
+        needle.reserve(pattern.size());
+        for (char c : pattern)
+        {
+            needle.push_back(fold(c));
+        }
+        if (!needle.empty())
+        {
+            firstLower = needle.front();
+            firstUpper = upper(firstLower);
+            lastLower = needle.back();
+            lastUpper = upper(lastLower);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return needle.size();
+    }
+
+    // Position of the first match at or after `from`, or npos.
+    std::size_t find(std::string_view hay, std::size_t from = 0) const
+    {
+        if (needle.empty())
+        {
+            return from <= hay.size() ? from : std::string_view::npos;
+        }
+        if (from >= hay.size() || hay.size() - from < needle.size())
+        {
+            return std::string_view::npos;
+        }
+        std::size_t i = from;
+#if defined(__SSE2__)
+        std::size_t pos = hasAvx2() ? findAvx2(hay, i) : findSse2(hay, i);
+        if (pos != std::string_view::npos)
+        {
+            return pos;
+        }
+#endif
+        return findScalar(hay, i);
+    }
+
+    bool foundIn(std::string_view hay) const
+    {
+        return find(hay) != std::string_view::npos;
+    }
+};
@@ -0,0 +1,681 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Arena.h"
+#include "Storage.h"
+
+// Byte-oriented LZ77 in the LZ4 block layout: each sequence is a token
+// (literal count in the high nibble, match length - 4 in the low one, 15
+// meaning "more bytes follow, 255 at a time"), the literals, and a 2-byte
+// little-endian match offset. The last sequence has literals only. Matches
+// come from a 4-byte hash table and reach back at most 65535 bytes.
+inline std::string lzCompress(std::string_view in)
+{
+    constexpr unsigned HASH_BITS = 12;
+    constexpr std::size_t MIN_MATCH = 4;
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(in.data());
+    const std::size_t n = in.size();
+    std::string out;
+    out.reserve(n + n / 255 + 16);
+
+    auto load32 = [&](std::size_t i)
+    {
+        std::uint32_t v;
+        std::memcpy(&v, src + i, sizeof(v));
+        return v;
+    };
+    auto putLength = [&](std::size_t length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            out.push_back(static_cast<char>(255));
+        }
+        out.push_back(static_cast<char>(length));
+    };
+    auto putLiterals = [&](std::size_t from, std::size_t to, std::size_t matchCode)
+    {
+        std::size_t literals = to - from;
+        out.push_back(static_cast<char>(std::min<std::size_t>(literals, 15) << 4 | std::min<std::size_t>(matchCode, 15)));
+        if (literals >= 15)
+        {
+            putLength(literals - 15);
+        }
+        out.append(in.data() + from, literals);
+    };
+
+    std::vector<std::uint32_t> table(1u << HASH_BITS, UINT32_MAX);
+    std::size_t anchor = 0, i = 0;
+    while (i + MIN_MATCH <= n)
+    {
+        std::uint32_t seq = load32(i);
+        std::uint32_t &slot = table[(seq * 2654435761u) >> (32 - HASH_BITS)];
+        std::size_t candidate = slot;
+        slot = static_cast<std::uint32_t>(i);
+        if (candidate == UINT32_MAX || i - candidate > 65535 || load32(candidate) != seq)
+        {
+            // Step faster through data that keeps missing.
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        std::size_t length = MIN_MATCH;
+        while (i + length < n && src[candidate + length] == src[i + length])
+        {
+            ++length;
+        }
+        putLiterals(anchor, i, length - MIN_MATCH);
+        std::size_t offset = i - candidate;
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (length - MIN_MATCH >= 15)
+        {
+            putLength(length - MIN_MATCH - 15);
+        }
+        i += length;
+        anchor = i;
+    }
+    putLiterals(anchor, n, 0);
+    return out;
+}
+
+// Inverse of lzCompress; false if the input is corrupt, is cut short (it
+// must end with the literals-only sequence) or does not decode to exactly
+// outSize bytes.
+inline bool lzDecompress(std::string_view in, char *out, std::size_t outSize)
+{
+    const unsigned char *ip = reinterpret_cast<const unsigned char *>(in.data());
+    const unsigned char *end = ip + in.size();
+    std::size_t op = 0;
+    auto getLength = [&](std::size_t &length)
+    {
+        unsigned char b;
+        do
+        {
+            if (ip == end)
+            {
+                return false;
+            }
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip < end)
+    {
+        unsigned token = *ip++;
+        std::size_t literals = token >> 4;
+        if (literals == 15 && !getLength(literals))
+        {
+            return false;
+        }
+        if (literals > static_cast<std::size_t>(end - ip) || literals > outSize - op)
+        {
+            return false;
+        }
+        std::memcpy(out + op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end)
+        {
+            return op == outSize;
+        }
+        if (end - ip < 2)
+        {
+            return false;
+        }
+        std::size_t offset = ip[0] | static_cast<std::size_t>(ip[1]) << 8;
+        ip += 2;
+        std::size_t length = token & 15;
+        if (length == 15 && !getLength(length))
+        {
+            return false;
+        }
+        length += 4;
+        if (offset == 0 || offset > op || length > outSize - op)
+        {
+            return false;
+        }
+        // Overlapping copies repeat the last `offset` bytes, so go byte-wise.
+        if (offset >= length)
+        {
+            std::memcpy(out + op, out + op - offset, length);
+        }
+        else
+        {
+            for (std::size_t k = 0; k < length; ++k)
+            {
+                out[op + k] = out[op + k - offset];
+            }
+        }
+        op += length;
+    }
+    return false;
+}
+
+// A text body plus a share of the buffer holding it: a resident pool chunk
+// or a decompressed cold block. The view stays valid while the PinnedText
+// (or a copy) lives, even if the pool demotes the chunk or the cache drops
+// the block meanwhile.
+class PinnedText
+{
+private:
+    std::shared_ptr<const std::string> owner;
+    std::string_view text;
+
+public:
+    PinnedText() = default;
+    PinnedText(std::shared_ptr<const std::string> owner, std::string_view text) : owner(std::move(owner)), text(text) {}
+
+    std::string_view view() const
+    {
+        return text;
+    }
+
+    operator std::string_view() const
+    {
+        return text;
+    }
+
+    const char *data() const
+    {
+        return text.data();
+    }
+
+    std::size_t size() const
+    {
+        return text.size();
+    }
+
+    friend bool operator==(const PinnedText &a, std::string_view b)
+    {
+        return a.text == b;
+    }
+
+    friend bool operator!=(const PinnedText &a, std::string_view b)
+    {
+        return a.text != b;
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const PinnedText &t)
+    {
+        return out << t.text;
+    }
+};
+
+struct TextPoolStats
+{
+    std::size_t residentBytes = 0; // resident chunks plus cached blocks
+    std::size_t coldChunks = 0;
+    std::size_t coldBytes = 0;     // compressed, in the segment file
+    std::size_t cacheHits = 0;
+    std::size_t cacheMisses = 0;
+};
+
+// Append-only character storage. Bodies are packed back to back in large
+// chunks rather than each owning a heap buffer; a body never straddles two
+// chunks, and one larger than a chunk gets a chunk of its own.
+//
+// With cold storage enabled, only the newest chunks stay in memory. Older
+// ones are cut into blocks of about BLOCK_BYTES at text boundaries,
+// compressed, appended to a segment file and mapped read-only; the chunk's
+// memory is then released. A read of a cold text decompresses its block
+// into a small LRU cache of blocks, so resident memory is bounded by the
+// resident chunks plus the cache, however large the pool grows.
+class TextPool
+{
+private:
+    static constexpr std::size_t CHUNK_BYTES = 1 << 20;
+    static constexpr std::size_t BLOCK_BYTES = 64 << 10;
+
+    struct ColdBlock
+    {
+        std::uint32_t begin;          // chunk offset of the first byte
+        std::uint32_t length;         // uncompressed
+        std::uint32_t mappedOffset;   // within the chunk's mapping
+        std::uint32_t mappedLength;   // compressed
+    };
+
+    struct Chunk
+    {
+        std::shared_ptr<std::string> data; // null once the chunk is cold
+        std::vector<std::uint32_t> textEnds;
+        std::vector<ColdBlock> blocks;
+        const char *mapped = nullptr;
+        std::uint64_t mappedAt = 0;   // offset in the segment file
+        std::size_t mappedLength = 0;
+    };
+
+    struct CachedBlock
+    {
+        std::uint64_t key;
+        std::shared_ptr<const std::string> text;
+    };
+
+    std::vector<Chunk> chunks;
+    std::size_t totalBytes = 0;
+
+    int segmentFd = -1;
+    std::uint64_t segmentEnd = 0;
+    std::size_t residentChunks = 0;
+    std::size_t firstResident = 0; // chunks before it are cold
+    std::size_t coldBytes = 0;
+
+    // Decompressed blocks, most recent first, keyed by chunk << 32 | block.
+    mutable std::mutex cacheMtx;
+    mutable std::list<CachedBlock> cache;
+    mutable std::unordered_map<std::uint64_t, std::list<CachedBlock>::iterator> cached;
+    mutable std::size_t cachedBytes = 0;
+    mutable std::size_t cacheHits = 0;
+    mutable std::size_t cacheMisses = 0;
+    std::size_t cacheCapacity = 0;
+
+    // Block of the cold chunk holding chunk offset `offset`.
+    static std::size_t blockAt(const Chunk &c, std::uint32_t offset)
+    {
+        auto it = std::upper_bound(c.blocks.begin(), c.blocks.end(), offset, [](std::uint32_t off, const ColdBlock &b)
+                                   { return off < b.begin; });
+        return static_cast<std::size_t>(it - c.blocks.begin()) - 1;
+    }
+
+    std::shared_ptr<const std::string> decompress(const Chunk &c, std::size_t block) const
+    {
+        const ColdBlock &b = c.blocks[block];
+        auto text = std::make_shared<std::string>(b.length, '\0');
+        if (!lzDecompress(std::string_view(c.mapped + b.mappedOffset, b.mappedLength), text->data(), b.length))
+        {
+            text->clear(); // unreadable segment; the body reads as empty
+        }
+        return text;
+    }
+
+    // The decompressed block, from the cache if possible. With remember
+    // false a miss is not added to the cache, so a one-off sweep over the
+    // pool does not push out the blocks that are being reused.
+    std::shared_ptr<const std::string> fetch(std::size_t chunk, std::size_t block, bool remember) const
+    {
+        std::uint64_t key = static_cast<std::uint64_t>(chunk) << 32 | block;
+        {
+            std::lock_guard<std::mutex> lock(cacheMtx);
+            auto it = cached.find(key);
+            if (it != cached.end())
+            {
+                cache.splice(cache.begin(), cache, it->second);
+                cacheHits++;
+                return it->second->text;
+            }
+            cacheMisses++;
+        }
+        std::shared_ptr<const std::string> text = decompress(chunks[chunk], block);
+        if (!remember)
+        {
+            return text;
+        }
+        std::lock_guard<std::mutex> lock(cacheMtx);
+        if (cached.count(key) == 0)
+        {
+            cache.push_front({key, text});
+            cached.emplace(key, cache.begin());
+            cachedBytes += text->size();
+            while (cachedBytes > cacheCapacity && cache.size() > 1)
+            {
+                cachedBytes -= cache.back().text->size();
+                cached.erase(cache.back().key);
+                cache.pop_back();
+            }
+        }
+        return text;
+    }
+
+    // Maps length bytes of the segment file at offset at as chunk c's
+    // compressed blocks.
+    bool mapChunk(Chunk &c, std::uint64_t at, std::size_t length)
+    {
+        void *addr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, segmentFd, static_cast<off_t>(at));
+        if (addr == MAP_FAILED)
+        {
+            return false;
+        }
+        ::madvise(addr, length, MADV_RANDOM);
+        c.mapped = static_cast<const char *>(addr);
+        c.mappedAt = at;
+        c.mappedLength = length;
+        coldBytes += length;
+        return true;
+    }
+
+    // Moves a sealed chunk to the segment file. On any I/O failure the
+    // chunk simply stays resident.
+    bool demote(std::size_t index)
+    {
+        Chunk &c = chunks[index];
+        if (c.textEnds.empty() || c.textEnds.back() != c.data->size())
+        {
+            // Part of the chunk was stored without cold storage enabled, so
+            // its text boundaries are unknown: that part becomes one block.
+            c.textEnds.push_back(static_cast<std::uint32_t>(c.data->size()));
+        }
+        std::string compressed;
+        std::vector<ColdBlock> blocks;
+        std::uint32_t begin = 0;
+        for (std::size_t t = 0; t < c.textEnds.size(); ++t)
+        {
+            std::uint32_t end = c.textEnds[t];
+            if (end - begin < BLOCK_BYTES && t + 1 < c.textEnds.size())
+            {
+                continue;
+            }
+            std::string packed = lzCompress(std::string_view(c.data->data() + begin, end - begin));
+            blocks.push_back({begin, end - begin, static_cast<std::uint32_t>(compressed.size()), static_cast<std::uint32_t>(packed.size())});
+            compressed += packed;
+            begin = end;
+        }
+        if (compressed.empty())
+        {
+            return false;
+        }
+
+        // Every chunk starts on a page boundary so it can be mapped alone.
+        std::uint64_t at = (segmentEnd + pageBytes() - 1) / pageBytes() * pageBytes();
+        std::size_t written = 0;
+        while (written < compressed.size())
+        {
+            ssize_t n = ::pwrite(segmentFd, compressed.data() + written, compressed.size() - written, static_cast<off_t>(at + written));
+            if (n <= 0)
+            {
+                return false;
+            }
+            written += static_cast<std::size_t>(n);
+        }
+        if (!mapChunk(c, at, compressed.size()))
+        {
+            return false;
+        }
+        segmentEnd = at + compressed.size();
+        c.blocks = std::move(blocks);
+        c.data.reset();
+        std::vector<std::uint32_t>().swap(c.textEnds);
+        return true;
+    }
+
+    static std::uint64_t pageBytes()
+    {
+        return static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    }
+
+    void demoteOldChunks()
+    {
+        // The last chunk is still being filled and never leaves memory.
+        while (segmentFd >= 0 && residentChunks != 0 && chunks.size() > firstResident + 1 + residentChunks)
+        {
+            if (!demote(firstResident))
+            {
+                return;
+            }
+            firstResident++;
+        }
+    }
+
+public:
+    TextPool() = default;
+    TextPool(const TextPool &) = delete;
+    TextPool &operator=(const TextPool &) = delete;
+
+    ~TextPool()
+    {
+        for (Chunk &c : chunks)
+        {
+            if (c.mapped != nullptr)
+            {
+                ::munmap(const_cast<char *>(c.mapped), c.mappedLength);
+            }
+        }
+        if (segmentFd >= 0)
+        {
+            ::close(segmentFd);
+        }
+    }
+
+    // Keeps about residentBytes of the newest text in memory and moves
+    // older chunks to the segment file at path; cacheBytes bounds the
+    // decompressed block cache. The segment is only ever appended to, so
+    // chunks a snapshot refers to stay valid, and load() maps them back
+    // instead of rebuilding them. With residentBytes 0 nothing new is moved
+    // out, but cold chunks from an earlier snapshot are still read from
+    // path. Call before the first add() or load().
+    bool enableColdStorage(const std::string &path, std::size_t residentBytes, std::size_t cacheBytes)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (residentBytes != 0 ? O_CREAT : 0), 0644);
+        if (fd < 0)
+        {
+            return residentBytes == 0 && errno == ENOENT;
+        }
+        if (segmentFd >= 0)
+        {
+            ::close(segmentFd);
+        }
+        segmentFd = fd;
+        segmentEnd = 0;
+        residentChunks = residentBytes == 0 ? 0 : std::max<std::size_t>(1, residentBytes / CHUNK_BYTES);
+        cacheCapacity = cacheBytes;
+        return true;
+    }
+
+    // Makes the segment file durable; a snapshot may only refer to cold
+    // chunks once this has succeeded.
+    bool sync()
+    {
+        return segmentFd < 0 || ::fdatasync(segmentFd) == 0;
+    }
+
+    TextRef add(std::string_view text)
+    {
+        if (chunks.empty() || chunks.back().data->size() + text.size() > chunks.back().data->capacity())
+        {
+            chunks.emplace_back();
+            chunks.back().data = std::make_shared<std::string>();
+            chunks.back().data->reserve(std::max(CHUNK_BYTES, text.size()));
+            demoteOldChunks();
+        }
+        Chunk &c = chunks.back();
+        TextRef ref;
+        ref.chunk = static_cast<std::uint32_t>(chunks.size() - 1);
+        ref.offset = static_cast<std::uint32_t>(c.data->size());
+        ref.length = static_cast<std::uint32_t>(text.size());
+        c.data->append(text.data(), text.size());
+        if (residentChunks != 0)
+        {
+            c.textEnds.push_back(static_cast<std::uint32_t>(c.data->size()));
+        }
+        totalBytes += text.size();
+        return ref;
+    }
+
+    PinnedText get(TextRef ref) const
+    {
+        return span(ref, ref);
+    }
+
+    // Texts first .. last as one view, including everything stored between
+    // them. Both must lie in the same storage unit (see unitOf).
+    PinnedText span(TextRef first, TextRef last, bool remember = true) const
+    {
+        const Chunk &c = chunks[first.chunk];
+        std::size_t length = last.offset + last.length - first.offset;
+        if (c.data)
+        {
+            return PinnedText(c.data, std::string_view(c.data->data() + first.offset, length));
+        }
+        std::size_t block = blockAt(c, first.offset);
+        std::shared_ptr<const std::string> text = fetch(first.chunk, block, remember);
+        std::size_t at = first.offset - c.blocks[block].begin;
+        if (at + length > text->size())
+        {
+            return PinnedText();
+        }
+        return PinnedText(text, std::string_view(text->data() + at, length));
+    }
+
+    // Texts with the same unit are stored contiguously: the whole chunk
+    // while it is resident, one block once it is cold.
+    std::uint64_t unitOf(TextRef ref) const
+    {
+        const Chunk &c = chunks[ref.chunk];
+        std::uint64_t block = c.data ? UINT32_MAX : blockAt(c, ref.offset);
+        return static_cast<std::uint64_t>(ref.chunk) << 32 | block;
+    }
+
+    // Whether ref lies within the stored text, e.g. after a load.
+    bool contains(TextRef ref) const
+    {
+        if (ref.chunk >= chunks.size())
+        {
+            return false;
+        }
+        const Chunk &c = chunks[ref.chunk];
+        std::uint64_t length = c.data ? c.data->size() : c.blocks.back().begin + c.blocks.back().length;
+        return static_cast<std::uint64_t>(ref.offset) + ref.length <= length;
+    }
+
+    // Resident chunks are written out in full; cold ones only as their
+    // place in the segment file, which must have been sync()ed.
+    void save(BinaryWriter &out) const
+    {
+        out.put<std::uint32_t>(static_cast<std::uint32_t>(chunks.size()));
+        for (const Chunk &c : chunks)
+        {
+            out.put<std::uint8_t>(c.data ? 0 : 1);
+            if (c.data)
+            {
+                out.putString(*c.data);
+                out.put<std::uint32_t>(static_cast<std::uint32_t>(c.textEnds.size()));
+                out.putBytes(c.textEnds.data(), c.textEnds.size() * sizeof(std::uint32_t));
+            }
+            else
+            {
+                out.put<std::uint64_t>(c.mappedAt);
+                out.put<std::uint64_t>(c.mappedLength);
+                out.put<std::uint32_t>(static_cast<std::uint32_t>(c.blocks.size()));
+                out.putBytes(c.blocks.data(), c.blocks.size() * sizeof(ColdBlock));
+            }
+        }
+    }
+
+    // Into an empty pool. Cold chunks are mapped from the segment file and
+    // anything written there after them (by a session that never reached
+    // its next snapshot) is cut off.
+    bool load(BinaryReader &in)
+    {
+        struct stat st;
+        std::uint64_t segmentBytes = segmentFd >= 0 && ::fstat(segmentFd, &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+        std::uint32_t n = in.get<std::uint32_t>();
+        for (std::uint32_t i = 0; i < n && !in.failed(); ++i)
+        {
+            chunks.emplace_back();
+            Chunk &c = chunks.back();
+            if (in.get<std::uint8_t>() == 0)
+            {
+                std::string_view text = in.getString();
+                std::uint32_t ends = in.get<std::uint32_t>();
+                const std::uint32_t *first = static_cast<const std::uint32_t *>(in.getBytes(ends * sizeof(std::uint32_t)));
+                if (in.failed())
+                {
+                    return false;
+                }
+                c.data = std::make_shared<std::string>();
+                c.data->reserve(i + 1 == n ? std::max(CHUNK_BYTES, text.size()) : text.size());
+                c.data->append(text.data(), text.size());
+                if (residentChunks != 0)
+                {
+                    c.textEnds.assign(first, first + ends);
+                }
+                totalBytes += text.size();
+                continue;
+            }
+            // Cold chunks only ever precede resident ones.
+            if (i != firstResident)
+            {
+                return false;
+            }
+            std::uint64_t at = in.get<std::uint64_t>();
+            std::uint64_t length = in.get<std::uint64_t>();
+            std::uint32_t count = in.get<std::uint32_t>();
+            const ColdBlock *first = static_cast<const ColdBlock *>(in.getBytes(count * sizeof(ColdBlock)));
+            if (in.failed() || count == 0 || length == 0 || at % pageBytes() != 0 || at + length > segmentBytes ||
+                !mapChunk(c, at, length))
+            {
+                return false;
+            }
+            c.blocks.assign(first, first + count);
+            std::uint64_t end = 0;
+            for (const ColdBlock &b : c.blocks)
+            {
+                if (b.begin != end || static_cast<std::uint64_t>(b.mappedOffset) + b.mappedLength > length)
+                {
+                    return false;
+                }
+                end += b.length;
+            }
+            totalBytes += end;
+            segmentEnd = at + length;
+            firstResident++;
+        }
+        if (in.failed())
+        {
+            return false;
+        }
+        if (segmentFd >= 0 && segmentBytes > segmentEnd && ::ftruncate(segmentFd, static_cast<off_t>(segmentEnd)) != 0)
+        {
+            return false;
+        }
+        // The snapshot may have been taken with more text resident.
+        demoteOldChunks();
+        return true;
+    }
+
+    std::size_t bytes() const
+    {
+        return totalBytes;
+    }
+
+    // Memory held: resident chunk buffers (including the unused tail of
+    // each) plus the decompressed block cache.
+    std::size_t capacityBytes() const
+    {
+        std::size_t total = 0;
+        for (std::size_t i = firstResident; i < chunks.size(); ++i)
+        {
+            if (chunks[i].data)
+            {
+                total += chunks[i].data->capacity() + chunks[i].textEnds.capacity() * sizeof(std::uint32_t);
+            }
+        }
+        std::lock_guard<std::mutex> lock(cacheMtx);
+        return total + cachedBytes;
+    }
+
+    TextPoolStats stats() const
+    {
+        TextPoolStats s;
+        s.residentBytes = capacityBytes();
+        s.coldChunks = firstResident;
+        s.coldBytes = coldBytes;
+        std::lock_guard<std::mutex> lock(cacheMtx);
+        s.cacheHits = cacheHits;
+        s.cacheMisses = cacheMisses;
+        return s;
+    }
+};